@@ -7,29 +7,130 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include "umInstructions.h"
+#include "segmentPool.h"
+#include "outputBuffer.h"
+#include "inputBuffer.h"
+#include "jit.h"
+#include "profiler.h"
+#include "perfCounters.h"
+#include "hugePages.h"
+
+/* What the command line asked for */
+typedef struct Um_options {
+    char *program;  /* the .um or .umz file to run, "-" for stdin */
+    int jit;        /* --jit: run segment 0 as compiled x86-64 code */
+    int alloc_stats; /* --alloc-stats: report segment allocations at halt */
+    char *snapshot; /* --snapshot-at-input: file written at the first input */
+    char *restore;  /* --restore: snapshot to resume instead of a program */
+    size_t output_buffer; /* --output-buffer=SIZE: bytes, 0 for default */
+    int null_output; /* --null-output: discard the program's output */
+    char *input_file; /* --input-file: input from this file, not stdin */
+    int stats;      /* --stats: count what the program does, report at halt */
+    char *profile;  /* --profile=FILE: sample the program counter, write the
+                       folded stacks to FILE and report at halt */
+    int perf;       /* --perf: hardware counters while the UM runs */
+    int huge_pages; /* --huge-pages: big tables and segments on 2 MB pages */
+} Um_options;
+
+static size_t parse_size(char *arg);
 
 
 /* 
  * checkCommandline
  * Description:
- * - Checks the command line for a valid program call
+ * - Checks the command line for a valid program call:
+ *     um [options] [--snapshot-at-input file] program.um
+ *     um [options] --restore file
+ *   where program.um may be "-" to read the program from standard input
+ *   and the options are --jit, --alloc-stats, --output-buffer=SIZE (bytes,
+ *   or with a K or M suffix), --null-output, --input-file file, --stats
+ *   and --profile=FILE (which run the interpreter, not --jit, and can't be
+ *   combined), --perf and --huge-pages
  * Parameters:
  * - Number of arguments on the command line (int argc)
  * - Array of arguments passed to command line (char** argv)
  * Effects:
  * - If an invalid call is made, exits the program.
  * Returns:
- * - None
+ * - The options given on the command line (Um_options)
  */
-void checkCommandline(int argc, char** argv)
+Um_options checkCommandline(int argc, char** argv)
 {
-    if (argc != 2) {
+    Um_options options = { NULL, 0, 0, NULL, NULL, 0, 0, NULL, 0, NULL, 0, 
+                           0 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            options.jit = 1;
+        } else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            options.alloc_stats = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = 1;
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            options.perf = 1;
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            options.huge_pages = 1;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0 && 
+                   argv[i][10] != '\0') {
+            options.profile = argv[i] + 10;
+        } else if (strncmp(argv[i], "--output-buffer=", 16) == 0) {
+            options.output_buffer = parse_size(argv[i] + 16);
+        } else if (strcmp(argv[i], "--null-output") == 0) {
+            options.null_output = 1;
+        } else if (strcmp(argv[i], "--snapshot-at-input") == 0 && 
+                   i + 1 < argc) {
+            options.snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            options.restore = argv[++i];
+        } else if (strcmp(argv[i], "--input-file") == 0 && i + 1 < argc) {
+            options.input_file = argv[++i];
+        } else if ((argv[i][0] == '-' && strcmp(argv[i], "-") != 0) ||
+                   options.program != NULL) {
+            fprintf(stderr, "Innapropriate command line argument %s\n", 
+                    argv[i]);
+            exit(EXIT_FAILURE);
+        } else {
+            options.program = argv[i];
+        }
+    }
+
+    if (options.stats && options.jit) {
+        fprintf(stderr, "--stats counts the interpreter, not --jit\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.profile != NULL && (options.jit || options.stats)) {
+        fprintf(stderr, "--profile samples the interpreter on its own, "
+                "without --jit or --stats\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef ARENA_SEGMENTS
+    if (options.snapshot != NULL || options.restore != NULL) {
+        fprintf(stderr, "Snapshots need the segment table; this um was "
+                "built with SEGMENTS=arena\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+    if (options.restore != NULL) {
+        if (options.program != NULL) {
+            fprintf(stderr, "--restore does not take a program\n");
+            exit(EXIT_FAILURE);
+        }
+        return options;
+    }
+
+    if (options.program == NULL) {
         fprintf(stderr, "Innapropriate number of command line arguments\n");
         exit(EXIT_FAILURE);
     }
 
-    char *ext = strrchr(argv[1], '.');
+    if (strcmp(options.program, "-") == 0) {
+        return options;
+    }
+
+    char *ext = strrchr(options.program, '.');
     if (!ext) { /* File extension does not exist */
         fprintf(stderr, "Innapropriate file extension\n");     
         exit(EXIT_FAILURE);
@@ -39,20 +140,96 @@ void checkCommandline(int argc, char** argv)
         fprintf(stderr, "Innapropriate file extension\n");     
         exit(EXIT_FAILURE);
     } 
+
+    return options;
+}
+
+/* 
+ * parse_size
+ * Description:
+ * - Reads the SIZE of --output-buffer=SIZE
+ * Parameters:
+ * - The text after the "=" (char *arg)
+ * Effects:
+ * - Exits if it is not a positive number of bytes, optionally followed by K
+ *   or M
+ * Returns:
+ * - The size in bytes (size_t)
+ */
+static size_t parse_size(char *arg)
+{
+    char *end;
+    unsigned long long size = strtoull(arg, &end, 10);
+    if (*end == 'K' || *end == 'k') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        size <<= 20;
+        end++;
+    }
+    if (end == arg || *end != '\0' || arg[0] == '-' || size == 0 || 
+        size > (1ull << 30)) {
+        fprintf(stderr, "Innapropriate output buffer size %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    return size;
 }
 
 int main(int argc, char** argv) 
 {
     /* check file extension */
-    checkCommandline(argc, argv);
+    Um_options options = checkCommandline(argc, argv);
     
     /* Create an instance of a UM*/
+    output_buffer_init(options.output_buffer, options.null_output);
+    input_buffer_init(options.input_file);
+    huge_pages = options.huge_pages;
     UM um = initialize_UM();
-    load_mem(argv[1], um);
+    if (options.restore != NULL) {
+        load_snapshot(options.restore, um);
+    } else {
+        load_mem(options.program, um);
+    }
+    um->snapshot_at_input = options.snapshot;
+    if (options.stats) {
+        enable_stats(um);
+    }
+    if (options.profile != NULL) {
+        profile_start(options.profile, um->program_counter);
+        um->profile = 1;
+    }
     
     /* Executes the instructions given in the file given on the command line */
-    execute_instr(um);
+    struct timespec start, end;
+    if (options.perf) {
+        perf_counters_start();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (options.jit) {
+        jit_execute(um);
+    } else {
+        execute_instr(um);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
     
+    if (options.perf) {
+        /* Per million UM instructions needs --stats to count them */
+        perf_counters_report(stderr, options.stats ? stats_instructions(um) 
+                                                   : 0);
+    }
+    if (options.stats) {
+        report_stats(um, stderr, (end.tv_sec - start.tv_sec) + 
+                                 (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+    if (options.profile != NULL) {
+        profile_finish(stderr);
+    }
+    if (options.alloc_stats) {
+        segment_pool_report(stderr);
+    }
+
     /* Frees heap allocated memory associated with the Universal Machine */
+    segment_pool_free();
+    input_buffer_free();
     free(um);
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+/* genHandlers.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Writes umHandlers.h, the register-specialized handlers of the
+ * specialized dispatch engine (make DISPATCH=specialized), to stdout.
+ *
+ * Every instruction that only works on registers gets one handler per
+ * combination of registers a, b and c (512 per opcode), with the register
+ * numbers written into the handler as constants, so running one of them
+ * never looks at the instruction's operands. decode_segment_zero stores
+ * the number of the handler each word of segment 0 runs in a side array,
+ * and the cycle jumps through it straight to the handler. The entry after
+ * the last word is the generic invalid opcode handler, so running off the
+ * end fails as it does in the other engines.
+ *
+ * The header is included three times, and what it holds depends on which
+ * of these is defined:
+ *  - UM_HANDLERS_ENTRIES: specialized_entries, the dispatch table entry of
+ *    each opcode's first handler, and SPECIALIZED_END, the entry after the
+ *    last one (file scope, umInstructions.c)
+ *  - UM_HANDLERS_LABELS: the handlers' addresses, in dispatch table order
+ *  - neither: the handlers themselves, in the body of the cycle (umCycle.h)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Entries of the dispatch table before the first specialized handler: one
+   generic handler for each of the 16 possible opcodes */
+#define GENERIC_ENTRIES 16
+
+/* The specialized opcodes, in dispatch table order */
+static const struct {
+    int opcode;
+    const char *name;
+    const char *body; /* printf format; takes a, b, c as arguments 1 to 3 */
+} specialized[] = {
+    { 0, "CMOV", "if (r[%3$d] != 0) { r[%1$d] = r[%2$d]; }" },
+    { 3, "ADD",  "r[%1$d] = r[%2$d] + r[%3$d];" },
+    { 4, "MUL",  "r[%1$d] = r[%2$d] * r[%3$d];" },
+#ifdef TRAP_CHECKS
+    /* Dividing by 0 faults (see trapChecks.c), except r / r, which gcc 
+       folds to 1 */
+    { 5, "DIV",  "if (%2$d == %3$d && r[%3$d] == 0) { goto divide_by_zero; } "
+                 "r[%1$d] = r[%2$d] / r[%3$d];" },
+#else
+    { 5, "DIV",  "if (r[%3$d] == 0) { goto divide_by_zero; } "
+                 "r[%1$d] = r[%2$d] / r[%3$d];" },
+#endif
+    { 6, "NAND", "r[%1$d] = ~(r[%2$d] & r[%3$d]);" },
+};
+
+#define NUM_SPECIALIZED (sizeof(specialized) / sizeof(specialized[0]))
+
+/********************* Private Function Declarations *************************/
+static void print_entries();
+static void print_labels();
+static void print_bodies();
+
+/************************** Function Definitions *****************************/
+
+int main()
+{
+    printf("/* umHandlers.h\n"
+           " * Generated by genHandlers; do not edit.\n"
+           " * Register-specialized handlers for DISPATCH=specialized, see\n"
+           " * genHandlers.c.\n"
+           " */\n\n");
+
+    printf("#if defined(UM_HANDLERS_ENTRIES)\n\n");
+    print_entries();
+    printf("\n#elif defined(UM_HANDLERS_LABELS)\n\n");
+    print_labels();
+    printf("\n#else\n\n");
+    print_bodies();
+    printf("\n#endif\n");
+
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        fprintf(stderr, "genHandlers: cannot write output\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/************************** Helper Functions *********************************/
+
+/*
+ * print_entries
+ * Description:
+ * - Prints specialized_entries, indexed by opcode: the dispatch table entry
+ *   of the opcode's handler for registers 0, 0, 0, or 0 if the opcode only
+ *   has its generic handler. The handler for registers a, b and c is at
+ *   that entry + a * 64 + b * 8 + c. Then SPECIALIZED_END, the first entry
+ *   after them
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+static void print_entries()
+{
+    int first[GENERIC_ENTRIES] = { 0 };
+    for (size_t i = 0; i < NUM_SPECIALIZED; i++) {
+        first[specialized[i].opcode] = GENERIC_ENTRIES + i * 512;
+    }
+
+    printf("static const uint16_t specialized_entries[%d] = {\n   ",
+           GENERIC_ENTRIES);
+    for (int opcode = 0; opcode < GENERIC_ENTRIES; opcode++) {
+        printf(" %d,", first[opcode]);
+    }
+    printf("\n};\n\n");
+    printf("/* First dispatch table entry after the specialized handlers */\n");
+    printf("#define SPECIALIZED_END %d\n", 
+           GENERIC_ENTRIES + (int)NUM_SPECIALIZED * 512);
+}
+
+/*
+ * print_labels
+ * Description:
+ * - Prints the address of every specialized handler, to follow the generic
+ *   handlers in the cycle's dispatch table
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+static void print_labels()
+{
+    for (size_t i = 0; i < NUM_SPECIALIZED; i++) {
+        for (int reg = 0; reg < 512; reg++) {
+            printf("&&op_%s_%d%d%d,%s", specialized[i].name, reg >> 6,
+                   (reg >> 3) & 7, reg & 7, (reg & 7) == 7 ? "\n" : " ");
+        }
+    }
+}
+
+/*
+ * print_bodies
+ * Description:
+ * - Prints every specialized handler, each ending in NEXT like the
+ *   generic ones
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+static void print_bodies()
+{
+    for (size_t i = 0; i < NUM_SPECIALIZED; i++) {
+        for (int reg = 0; reg < 512; reg++) {
+            int a = reg >> 6, b = (reg >> 3) & 7, c = reg & 7;
+            printf("op_%s_%d%d%d: ", specialized[i].name, a, b, c);
+            printf(specialized[i].body, a, b, c);
+            printf(" NEXT;\n");
+        }
+    }
+}
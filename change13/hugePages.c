@@ -0,0 +1,125 @@
+/* hugePages.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Huge page allocations behind --huge-pages.
+ *
+ * The UM's randomly accessed memory (large segments, including segment 0
+ * of programs like codex, the decoded instruction cache and the segment
+ * table) is spread over more 4 KB pages than the data TLB holds. With
+ * --huge-pages, each of those comes from its own anonymous mapping,
+ * aligned to and rounded up to 2 MB and marked MADV_HUGEPAGE, so that the
+ * kernel can back it with transparent huge pages: one TLB entry per 2 MB
+ * instead of per 4 KB. The kernel may still fall back to small pages (when
+ * THP is disabled, or no 2 MB of contiguous memory is free), which only
+ * loses the benefit.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "hugePages.h"
+
+int huge_pages;
+
+/********************* Private Function Declarations *************************/
+static inline size_t round_up(size_t bytes);
+
+/************************** Function Definitions *****************************/
+
+/*
+ * huge_pages_map
+ * Description:
+ * - Maps zeroed memory on 2 MB boundaries and asks for huge pages for it
+ * Parameters:
+ * - Its size in bytes (size_t bytes)
+ * Returns:
+ * - The start of the region (void *), or NULL if it can't be mapped;
+ *   release it with huge_pages_unmap
+ */
+void *huge_pages_map(size_t bytes)
+{
+    size_t size = round_up(bytes);
+
+    /* Map a huge page more than needed, then trim to the boundary */
+    char *start = mmap(NULL, size + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED) {
+        return NULL;
+    }
+    char *aligned = (char *)round_up((uintptr_t)start);
+    if (aligned > start) {
+        munmap(start, aligned - start);
+    }
+    munmap(aligned + size, start + HUGE_PAGE_BYTES - aligned);
+
+    madvise(aligned, size, MADV_HUGEPAGE);
+    return aligned;
+}
+
+/*
+ * huge_pages_unmap
+ * Description:
+ * - Releases a region from huge_pages_map
+ * Parameters:
+ * - The region, as given to huge_pages_map (void *start, size_t bytes)
+ * Returns:
+ * - None
+ */
+void huge_pages_unmap(void *start, size_t bytes)
+{
+    munmap(start, round_up(bytes));
+}
+
+/*
+ * huge_pages_alloc
+ * Description:
+ * - Allocates memory that isn't initialized: huge pages with --huge-pages,
+ *   malloc otherwise
+ * Parameters:
+ * - Its size in bytes (size_t bytes)
+ * Returns:
+ * - The memory (void *), or NULL if it can't be allocated; release it with
+ *   huge_pages_release
+ */
+void *huge_pages_alloc(size_t bytes)
+{
+    return huge_pages ? huge_pages_map(bytes) : malloc(bytes);
+}
+
+/*
+ * huge_pages_release
+ * Description:
+ * - Releases memory from huge_pages_alloc
+ * Parameters:
+ * - The memory and its size as given to huge_pages_alloc 
+ *   (void *start, size_t bytes); NULL is ignored
+ * Returns:
+ * - None
+ */
+void huge_pages_release(void *start, size_t bytes)
+{
+    if (start == NULL) {
+        return;
+    }
+    if (huge_pages) {
+        huge_pages_unmap(start, bytes);
+    } else {
+        free(start);
+    }
+}
+
+/************************** Helper Functions *********************************/
+
+/*
+ * round_up
+ * Description:
+ * - Rounds a size or an address up to a whole number of huge pages
+ * Parameters:
+ * - The size or address (size_t bytes)
+ * Returns:
+ * - The rounded value (size_t)
+ */
+size_t round_up(size_t bytes)
+{
+    return (bytes + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+}
@@ -0,0 +1,23 @@
+/* hugePages.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Interface of the huge page allocations behind --huge-pages.
+ */
+
+#ifndef HUGEPAGES_H_INCLUDED
+#define HUGEPAGES_H_INCLUDED
+
+#include <stddef.h>
+
+/* Bytes of a huge page, and the alignment of a region from huge_pages_map */
+#define HUGE_PAGE_BYTES ((size_t)2 << 20)
+
+/* Set by --huge-pages before the UM is initialized, never changed after */
+extern int huge_pages;
+
+void *huge_pages_map(size_t bytes);
+void huge_pages_unmap(void *start, size_t bytes);
+void *huge_pages_alloc(size_t bytes);
+void huge_pages_release(void *start, size_t bytes);
+
+#endif
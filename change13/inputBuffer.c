@@ -0,0 +1,149 @@
+/* inputBuffer.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Buffer behind the UM's input instruction.
+ *
+ * Standard input is read() a chunk at a time into a buffer and handed out
+ * one byte per input instruction, without going through stdio. A read
+ * returns as soon as any input is there, so an interactive program still
+ * gets each line as it is typed, and the output buffer is flushed before
+ * each read so the program's prompt is showing while it waits. Input that
+ * is already buffered costs no system call either way. An input file given
+ * with --input-file is mapped whole instead, and its end is the end of the
+ * input.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assert.h"
+#include "inputBuffer.h"
+#include "outputBuffer.h"
+
+#define CHUNK_SIZE (64 * 1024)
+
+struct Input_buffer input_buffer;
+
+static int input_fd = STDIN_FILENO; /* -1 once there is nothing to read */
+static uint8_t *chunk;              /* what read() fills */
+static uint8_t *mapped;             /* the mapped input file, if any */
+static size_t mapped_size;
+
+/************************** Function Definitions *****************************/
+
+/*
+ * input_buffer_init
+ * Description:
+ * - Chooses where the UM's input comes from; called once before it runs
+ * Parameters:
+ * - File to use as the input, NULL for standard input (char *filename)
+ * Effects:
+ * - Maps the file, or allocates the buffer standard input is read into;
+ *   exits if the file can't be opened
+ * Returns:
+ * - None
+ */
+void input_buffer_init(char *filename)
+{
+    input_buffer.next = input_buffer.end = NULL;
+    if (filename == NULL) {
+        input_fd = STDIN_FILENO;
+        chunk = malloc(CHUNK_SIZE);
+        assert(chunk != NULL);
+        return;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    struct stat buf;
+    if (fd < 0 || fstat(fd, &buf) != 0) {
+        fprintf(stderr, "Cannot read input file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Pipes and other files that can't be mapped are read like stdin */
+    if (S_ISREG(buf.st_mode) && buf.st_size > 0) {
+        mapped = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (mapped != NULL && mapped != MAP_FAILED) {
+        mapped_size = buf.st_size;
+        input_buffer.next = mapped;
+        input_buffer.end = mapped + mapped_size;
+        close(fd);
+        input_fd = -1;
+    } else if (S_ISREG(buf.st_mode) && buf.st_size == 0) {
+        mapped = NULL;
+        close(fd);
+        input_fd = -1;
+    } else {
+        mapped = NULL;
+        input_fd = fd;
+        chunk = malloc(CHUNK_SIZE);
+        assert(chunk != NULL);
+    }
+}
+
+/*
+ * input_buffer_refill
+ * Description:
+ * - Reads more input once the buffer is used up; see input_buffer_get
+ * Parameters:
+ * - None
+ * Effects:
+ * - Flushes the output buffer, then refills the input buffer with the next
+ *   read(); exits if the input can't be read
+ * Returns:
+ * - The next byte of input (int), EOF once there is no more
+ */
+int input_buffer_refill()
+{
+    if (input_fd >= 0) {
+        output_buffer_flush();
+    }
+    while (input_fd >= 0) {
+        ssize_t got = read(input_fd, chunk, CHUNK_SIZE);
+        if (got > 0) {
+            input_buffer.next = chunk + 1;
+            input_buffer.end = chunk + got;
+            return chunk[0];
+        }
+        if (got == 0) {
+            break;
+        }
+        if (errno != EINTR) {
+            fprintf(stderr, "Cannot read input\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Every later input is EOF too, without another read */
+    input_fd = -1;
+    return EOF;
+}
+
+/*
+ * input_buffer_free
+ * Description:
+ * - Releases the buffer or the mapped input file
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+void input_buffer_free()
+{
+    if (mapped != NULL) {
+        munmap(mapped, mapped_size);
+        mapped = NULL;
+    }
+    if (input_fd > STDIN_FILENO) {
+        close(input_fd);
+    }
+    input_fd = -1;
+    free(chunk);
+    chunk = NULL;
+    input_buffer.next = input_buffer.end = NULL;
+}
@@ -0,0 +1,33 @@
+/* inputBuffer.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Interface of the buffer behind the UM's input instruction.
+ */
+
+#ifndef INPUTBUFFER_H_INCLUDED
+#define INPUTBUFFER_H_INCLUDED
+
+#include <stdint.h>
+
+/* Bytes read but not yet input; use input_buffer_get */
+struct Input_buffer {
+    const uint8_t *next;
+    const uint8_t *end;
+};
+
+extern struct Input_buffer input_buffer;
+
+void input_buffer_init(char *filename);
+int input_buffer_refill();
+void input_buffer_free();
+
+/* Next byte of input (0 to 255), or EOF at the end of the input */
+static inline int input_buffer_get()
+{
+    if (input_buffer.next == input_buffer.end) {
+        return input_buffer_refill();
+    }
+    return *input_buffer.next++;
+}
+
+#endif
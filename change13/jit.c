@@ -0,0 +1,869 @@
+/* jit.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Baseline JIT: compiles basic blocks of segment 0 into x86-64 code.
+ *
+ * A block starts at some word of segment 0 and runs through the next load
+ * program, or up to (not including) the next halt or invalid opcode.
+ * Compiled blocks live in one mmap'd executable arena and are found through
+ * blocks[], indexed by the word of segment 0 they start at.
+ *
+ * While compiled code runs, UM register i lives in host register r(8 + i)
+ * and %rbx points at the Jit_state. Blocks never jump to each other
+ * directly: load program (and running off the end of a block) goes through
+ * a shared dispatch stub that looks the target up in blocks[], so dropping a
+ * block only takes clearing its entry.
+ *
+ * Falling back to the interpreter: map, unmap, output and input call out of
+ * the block into execute_step and carry on. Anything else the fast path does
+ * not handle (load program of another segment, stores into compiled words of
+ * segment 0, failure modes) leaves the compiled code and the interpreter
+ * executes that one instruction.
+ *
+ * Self-modifying code: compiled code stores straight into words of segment 0
+ * that no block was compiled from. A store into a compiled word drops every
+ * block covering it, and a load program that replaces segment 0 drops every
+ * block. Since plain stores skip um->decoded_zero, a word is redecoded from
+ * segment 0 before the interpreter executes it.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include "segmentPool.h"
+#include "jit.h"
+
+#define ARENA_SIZE (64 << 20)
+#define MAX_BLOCK_INSTRS 256
+
+/* Upper bound on the bytes one instruction compiles to, side exit stub
+   included */
+#define MAX_INSTR_BYTES 192
+
+typedef enum Um_opcode {
+        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
+} Um_opcode;
+
+/* Why compiled code returned to C */
+enum { EXIT_DISPATCH = 0, EXIT_STEP = 1 };
+
+/* What executing one instruction in the interpreter did */
+enum { STEP_CONTINUE, STEP_EXIT, STEP_HALTED };
+
+/* Host registers */
+enum { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8 };
+
+/* Condition codes for jcc */
+enum { CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5 };
+
+/* Everything compiled code reads, reached through %rbx */
+typedef struct Jit_state {
+    uint32_t *registers;       /* um->registers */
+    uint32_t *program_counter; /* &um->program_counter */
+    value_type *segments;      /* um->segmented_memory->array */
+    void **blocks;             /* compiled block starting at each word */
+    uint8_t *covered;          /* nonzero if word i was ever compiled */
+    uint32_t num_segments;     /* um->segmented_memory->size */
+    uint32_t zero_length;      /* number of words in segment 0 */
+    uint32_t zero_shared;      /* um->zero_shared_with */
+} Jit_state;
+
+typedef uint64_t (*Jit_enter)(Jit_state *state, void *block);
+
+typedef struct Jit {
+    Jit_state state;           /* first, so compiled code can pass a Jit */
+    UM um;
+    uint8_t *arena;
+    size_t arena_used;
+    size_t stubs_size;         /* arena bytes taken by the shared stubs */
+    Jit_enter enter;
+    uint8_t *exit_step;        /* leave compiled code, step the instruction */
+    uint8_t *exit_resume;      /* leave compiled code at the UM's pc */
+    uint8_t *dispatch;         /* jump to the block at the pc in %eax */
+    uint8_t *callout;          /* step the instruction at %eax in place */
+    uint32_t *block_end;       /* one past the last word of the block at i */
+    uint32_t *starts;          /* words at which a live block starts */
+    uint32_t num_starts;
+    uint32_t capacity;         /* words tracked by the block tables */
+} *Jit;
+
+/* A rel32 that still needs to be pointed at its side exit */
+typedef struct Jit_fixup {
+    uint8_t *at;
+    uint32_t pc;
+} Jit_fixup;
+
+/********************* Private Function Declarations *************************/
+static int jit_init(Jit jit, UM um);
+static void jit_free(Jit jit);
+static void jit_sync(Jit jit, UM um);
+static void jit_reset(Jit jit, UM um);
+static void jit_invalidate(Jit jit, uint32_t word);
+static int jit_step(Jit jit, UM um);
+static int jit_callout(Jit_state *state, uint32_t pc);
+static void *compile_block(Jit jit, UM um, uint32_t pc);
+static uint8_t *emit_stubs(uint8_t *p, Jit jit);
+static int ends_block(unsigned handler);
+
+/* x86-64 encoding */
+static inline uint8_t *emit8(uint8_t *p, uint8_t byte);
+static inline uint8_t *emit32(uint8_t *p, uint32_t value);
+static inline uint8_t *rex(uint8_t *p, int w, int reg, int index, int base);
+static inline uint8_t *op_rr(uint8_t *p, uint8_t opcode, int reg, int rm);
+static inline uint8_t *op_rr64(uint8_t *p, uint8_t opcode, int reg, int rm);
+static inline uint8_t *op_0f_rr(uint8_t *p, uint8_t opcode, int reg, int rm);
+static inline uint8_t *op_f7(uint8_t *p, int ext, int rm);
+static inline uint8_t *mov_imm(uint8_t *p, int reg, uint32_t imm);
+static inline uint8_t *op_state(uint8_t *p, int w, uint8_t opcode, int reg,
+                                size_t offset);
+static inline uint8_t *op_disp8(uint8_t *p, int w, uint8_t opcode, int reg,
+                                int base, int8_t disp);
+static inline uint8_t *op_sib(uint8_t *p, int w, uint8_t opcode, int reg,
+                              int base, int index, int scale);
+static inline uint8_t *test64(uint8_t *p, int reg);
+static inline uint8_t *test_sil_1(uint8_t *p);
+static inline uint8_t *save_registers(uint8_t *p);
+static inline uint8_t *load_registers(uint8_t *p);
+static inline uint8_t *jcc(uint8_t *p, int cc, Jit_fixup *fixup, uint32_t pc);
+static inline uint8_t *jcc_to(uint8_t *p, int cc, uint8_t *target);
+static inline uint8_t *jmp_to(uint8_t *p, uint8_t *target);
+static inline uint8_t *call_to(uint8_t *p, uint8_t *target);
+static inline void patch(uint8_t *at, uint8_t *target);
+
+/************************** Function Definitions *****************************/
+
+/*
+ * jit_execute
+ * Description:
+ * - Runs the UM until it halts, executing segment 0 as compiled blocks
+ *   wherever possible and one instruction at a time in the interpreter
+ *   everywhere else. Falls back to execute_instr when the host cannot run
+ *   the JIT.
+ * Parameters:
+ * - Pointer to an initialized universal machine struct (UM um)
+ * Effects:
+ * - Same as execute_instr
+ * Returns:
+ * - None
+ */
+void jit_execute(UM um)
+{
+    struct Jit jit;
+
+    if (!jit_init(&jit, um)) {
+        fprintf(stderr, "JIT unavailable, using the interpreter\n");
+        execute_instr(um);
+        return;
+    }
+
+    for (;;) {
+        uint32_t pc = um->program_counter;
+        Um_instruction *segment_zero = um->segmented_memory->array[0];
+
+        if (pc < jit.state.zero_length &&
+            !ends_block(decode_instr(segment_zero[pc]).handler)) {
+            void *block = jit.state.blocks[pc];
+            if (block == NULL) {
+                block = compile_block(&jit, um, pc);
+            }
+            uint64_t result = jit.enter(&jit.state, block);
+            um->program_counter = (uint32_t)result;
+            if ((result >> 32) == EXIT_DISPATCH) {
+                continue;
+            }
+        }
+
+        if (jit_step(&jit, um) == STEP_HALTED) {
+            break;
+        }
+    }
+
+    jit_free(&jit);
+}
+
+/************************** Block Management *********************************/
+
+/*
+ * jit_init
+ * Description:
+ * - Maps the executable arena, writes the shared stubs into it and sizes
+ *   the block tables for segment 0
+ * Parameters:
+ * - The JIT to initialize (Jit jit)
+ * - Pointer to a UM with a loaded segment 0 (UM um)
+ * Returns:
+ * - 1 on success, 0 if the host cannot run compiled code or segments are
+ *   in the arena (make SEGMENTS=arena), which compiled code doesn't know
+ */
+int jit_init(Jit jit, UM um)
+{
+#ifdef ARENA_SEGMENTS
+    /* Compiled code finds segments in the table */
+    return 0;
+#endif
+#if defined(__x86_64__)
+    jit->arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->arena == MAP_FAILED) {
+        return 0;
+    }
+
+    jit->um = um;
+    jit->enter = (Jit_enter)(uintptr_t)jit->arena;
+    jit->stubs_size = emit_stubs(jit->arena, jit) - jit->arena;
+    jit->arena_used = jit->stubs_size;
+
+    jit->state.registers = um->registers;
+    jit->state.program_counter = &um->program_counter;
+    jit->state.blocks = NULL;
+    jit->state.covered = NULL;
+    jit->block_end = NULL;
+    jit->starts = NULL;
+    jit->capacity = 0;
+    jit_reset(jit, um);
+    return 1;
+#else
+    (void) jit;
+    (void) um;
+    return 0;
+#endif
+}
+
+/*
+ * jit_free
+ * Description:
+ * - Releases the arena and block tables
+ * Parameters:
+ * - The JIT (Jit jit)
+ * Returns:
+ * - None
+ */
+void jit_free(Jit jit)
+{
+    munmap(jit->arena, ARENA_SIZE);
+    free(jit->state.blocks);
+    free(jit->state.covered);
+    free(jit->block_end);
+    free(jit->starts);
+}
+
+/*
+ * jit_sync
+ * Description:
+ * - Refreshes the copies of the UM's segment table that compiled code
+ *   reads; map and unmap may have moved them
+ * Parameters:
+ * - The JIT (Jit jit)
+ * - Pointer to the UM (UM um)
+ * Returns:
+ * - None
+ */
+void jit_sync(Jit jit, UM um)
+{
+    jit->state.segments = um->segmented_memory->array;
+    /* With all 2^32 IDs in use, the last one takes the interpreter */
+    jit->state.num_segments = um->segmented_memory->size > UINT32_MAX ?
+                              UINT32_MAX : um->segmented_memory->size;
+    jit->state.zero_length = segment_length(um->segmented_memory->array[0]);
+    jit->state.zero_shared = um->zero_shared_with;
+}
+
+/*
+ * jit_reset
+ * Description:
+ * - Drops every compiled block and sizes the block tables for the current
+ *   segment 0. Code that is running keeps running; its arena space is only
+ *   reused by the next compile_block.
+ * Parameters:
+ * - The JIT (Jit jit)
+ * - Pointer to the UM (UM um)
+ * Returns:
+ * - None
+ */
+void jit_reset(Jit jit, UM um)
+{
+    jit_sync(jit, um);
+
+    uint32_t length = jit->state.zero_length;
+    if (length > jit->capacity) {
+        free(jit->state.blocks);
+        free(jit->state.covered);
+        free(jit->block_end);
+        free(jit->starts);
+        jit->state.blocks = malloc((size_t)length * sizeof(void *));
+        jit->state.covered = malloc(length);
+        jit->block_end = malloc((size_t)length * sizeof(uint32_t));
+        jit->starts = malloc((size_t)length * sizeof(uint32_t));
+        assert(jit->state.blocks != NULL && jit->state.covered != NULL &&
+               jit->block_end != NULL && jit->starts != NULL);
+        jit->capacity = length;
+    }
+
+    memset(jit->state.blocks, 0, (size_t)length * sizeof(void *));
+    memset(jit->state.covered, 0, length);
+    jit->num_starts = 0;
+    jit->arena_used = jit->stubs_size;
+}
+
+/*
+ * jit_invalidate
+ * Description:
+ * - Drops every block whose code was compiled from the given word of
+ *   segment 0
+ * Parameters:
+ * - The JIT (Jit jit)
+ * - Index of the word that was overwritten (uint32_t word)
+ * Returns:
+ * - None
+ */
+void jit_invalidate(Jit jit, uint32_t word)
+{
+    if (word >= jit->state.zero_length || !jit->state.covered[word]) {
+        return;
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < jit->num_starts; i++) {
+        uint32_t start = jit->starts[i];
+        if (start <= word && word < jit->block_end[start]) {
+            jit->state.blocks[start] = NULL;
+        } else {
+            jit->starts[kept++] = start;
+        }
+    }
+    jit->num_starts = kept;
+}
+
+/*
+ * jit_step
+ * Description:
+ * - Executes the instruction at the program counter in the interpreter and
+ *   brings the JIT up to date with whatever it changed
+ * Parameters:
+ * - The JIT (Jit jit)
+ * - Pointer to the UM (UM um)
+ * Returns:
+ * - STEP_HALTED if the instruction was halt (the UM's memory is gone),
+ *   STEP_EXIT if compiled code must not run on past it (it jumped, or it
+ *   overwrote compiled code), STEP_CONTINUE otherwise
+ */
+int jit_step(Jit jit, UM um)
+{
+    uint32_t pc = um->program_counter;
+
+    /* A jump past segment 0 runs the invalid opcode after its last word */
+    if (pc > jit->state.zero_length) {
+        pc = um->program_counter = jit->state.zero_length;
+    }
+
+    /* Compiled code stores into segment 0 without redecoding */
+    if (pc < jit->state.zero_length) {
+        Um_instruction *segment_zero = um->segmented_memory->array[0];
+        um->decoded_zero[pc] = decode_instr(segment_zero[pc]);
+        if (um->decoded_entries != NULL) {
+            decode_entries(um, pc > ENTRY_REACH ? pc - ENTRY_REACH : 0, 
+                           pc + 1);
+        }
+    }
+
+    Um_decoded inst = um->decoded_zero[pc];
+    uint32_t av = um->registers[inst.a];
+    uint32_t bv = um->registers[inst.b];
+    uint32_t shared = um->zero_shared_with;
+
+    if (execute_step(um)) {
+        return STEP_HALTED;
+    }
+
+    /* Reloading the segment that segment 0 still shares changes nothing */
+    if (inst.handler == LOADP) {
+        if (bv != 0 && bv != shared) {
+            jit_reset(jit, um);
+        }
+        return STEP_EXIT;
+    }
+
+    jit_sync(jit, um);
+    if (inst.handler == SSTORE && av == 0 && bv < jit->state.zero_length &&
+        jit->state.covered[bv]) {
+        jit_invalidate(jit, bv);
+        return STEP_EXIT;
+    }
+    return STEP_CONTINUE;
+}
+
+/*
+ * jit_callout
+ * Description:
+ * - Called from compiled code (through the callout stub) to have the
+ *   interpreter execute one instruction without leaving the block
+ * Parameters:
+ * - The state compiled code runs with, the first member of its Jit
+ *   (Jit_state *state)
+ * - Word of segment 0 to execute (uint32_t pc)
+ * Returns:
+ * - 1 if the block may carry on with the next instruction, 0 if it must
+ *   exit to the pc now in um->program_counter
+ */
+int jit_callout(Jit_state *state, uint32_t pc)
+{
+    Jit jit = (Jit)state;
+    jit->um->program_counter = pc;
+    return jit_step(jit, jit->um) == STEP_CONTINUE;
+}
+
+/*
+ * ends_block
+ * Description:
+ * - Tells whether an instruction is left out of compiled code entirely
+ * Parameters:
+ * - The decoded handler of the instruction (unsigned handler)
+ * Returns:
+ * - 1 for halt and invalid opcodes, 0 otherwise
+ */
+int ends_block(unsigned handler)
+{
+    return handler == HALT || handler > LV;
+}
+
+/************************** Code Generation **********************************/
+
+/* Host register holding UM register i */
+#define UMREG(i) (R8 + (i))
+
+#define STATE(field) offsetof(Jit_state, field)
+
+/*
+ * emit_stubs
+ * Description:
+ * - Writes the code shared by every block at the start of the arena:
+ *     enter(state, block): saves the callee-saved registers, loads the UM
+ *       registers into r8-r15 and jumps to block
+ *     exit: stores the UM registers back and returns
+ *       ((uint64_t)%edx << 32) | %eax, i.e. the exit reason and the pc
+ *     exit_step / exit_dispatch / exit_resume: exit with the pc in %eax
+ *       (resume: in um->program_counter) and the matching reason
+ *     dispatch: jumps to blocks[%eax] if it is compiled, else exits with
+ *       EXIT_DISPATCH
+ *     callout: a function that runs jit_callout(state, %eax) with the UM
+ *       registers in memory and returns its result in %eax
+ * Parameters:
+ * - Where to write the code (uint8_t *p)
+ * - The JIT, whose stub addresses are filled in (Jit jit)
+ * Returns:
+ * - The address just past the stubs
+ */
+uint8_t *emit_stubs(uint8_t *p, Jit jit)
+{
+    /* enter */
+    p = emit8(p, 0x53);                                     /* push rbx */
+    p = emit8(p, 0x55);                                     /* push rbp */
+    for (int reg = 12; reg <= 15; reg++) {                  /* push r12-15 */
+        p = emit8(emit8(p, 0x41), 0x50 + (reg & 7));
+    }
+    p = emit32(p, 0x08ec8348);                              /* sub rsp, 8 */
+    p = op_rr64(p, 0x89, RDI, RBX);                         /* mov rbx,rdi */
+    p = load_registers(p);
+    p = emit8(emit8(p, 0xff), 0xe6);                        /* jmp rsi */
+
+    /* exit_resume */
+    jit->exit_resume = p;
+    p = op_state(p, 1, 0x8b, RAX, STATE(program_counter));
+    p = emit8(emit8(p, 0x8b), 0x00);                        /* mov eax,[rax] */
+
+    /* exit_dispatch */
+    uint8_t *exit_dispatch = p;
+    p = op_rr(p, 0x31, RDX, RDX);                           /* xor edx,edx */
+    uint8_t *to_exit = p + 1;
+    p = jmp_to(p, p);
+
+    /* exit_step */
+    jit->exit_step = p;
+    p = mov_imm(p, RDX, EXIT_STEP);
+
+    /* exit */
+    patch(to_exit, p);
+    p = save_registers(p);
+    p = emit32(p, 0x20e2c148);                              /* shl rdx, 32 */
+    p = op_rr(p, 0x89, RAX, RAX);                           /* mov eax,eax */
+    p = op_rr64(p, 0x09, RDX, RAX);                         /* or rax,rdx */
+    p = emit32(p, 0x08c48348);                              /* add rsp, 8 */
+    for (int reg = 15; reg >= 12; reg--) {                  /* pop r15-12 */
+        p = emit8(emit8(p, 0x41), 0x58 + (reg & 7));
+    }
+    p = emit8(p, 0x5d);                                     /* pop rbp */
+    p = emit8(p, 0x5b);                                     /* pop rbx */
+    p = emit8(p, 0xc3);                                     /* ret */
+
+    /* dispatch */
+    jit->dispatch = p;
+    p = op_state(p, 0, 0x3b, RAX, STATE(zero_length));      /* cmp eax,len */
+    p = jcc_to(p, CC_AE, exit_dispatch);
+    p = op_state(p, 1, 0x8b, RCX, STATE(blocks));
+    p = op_sib(p, 1, 0x8b, RCX, RCX, RAX, 3);          /* mov rcx,[rcx+rax*8] */
+    p = test64(p, RCX);
+    p = jcc_to(p, CC_E, exit_dispatch);
+    p = emit8(emit8(p, 0xff), 0xe1);                        /* jmp rcx */
+
+    /* callout */
+    jit->callout = p;
+    p = save_registers(p);
+    p = emit32(p, 0x08ec8348);                              /* sub rsp, 8 */
+    p = op_rr64(p, 0x89, RBX, RDI);                         /* mov rdi,rbx */
+    p = op_rr(p, 0x89, RAX, RSI);                           /* mov esi,eax */
+    p = emit8(emit8(p, 0x48), 0xb8);                        /* mov rax,imm64 */
+    uint64_t helper = (uint64_t)(uintptr_t)jit_callout;
+    memcpy(p, &helper, 8);
+    p += 8;
+    p = emit8(emit8(p, 0xff), 0xd0);                        /* call rax */
+    p = emit32(p, 0x08c48348);                              /* add rsp, 8 */
+    p = load_registers(p);
+    p = emit8(p, 0xc3);                                     /* ret */
+
+    return p;
+}
+
+/*
+ * compile_block
+ * Description:
+ * - Compiles the block of segment 0 that starts at pc and records it in
+ *   blocks[pc]. Flushes every block first if the arena is out of room.
+ * Parameters:
+ * - The JIT (Jit jit)
+ * - Pointer to the UM (UM um)
+ * - Word of segment 0 the block starts at; must not end a block itself
+ *   (uint32_t pc)
+ * Returns:
+ * - The compiled block
+ */
+void *compile_block(Jit jit, UM um, uint32_t pc)
+{
+    Jit_fixup fixups[MAX_BLOCK_INSTRS * 8];
+    int num_fixups = 0;
+
+    if (ARENA_SIZE - jit->arena_used < MAX_BLOCK_INSTRS * MAX_INSTR_BYTES) {
+        jit_reset(jit, um);
+    }
+
+    Um_instruction *segment_zero = um->segmented_memory->array[0];
+    uint8_t *block = jit->arena + jit->arena_used;
+    uint8_t *p = block;
+    uint32_t start = pc;
+    uint32_t length = jit->state.zero_length;
+    int done = 0;
+
+    while (!done) {
+        if (pc == length || pc - start == MAX_BLOCK_INSTRS) {
+            /* Fall through into whatever block comes next */
+            p = mov_imm(p, RAX, pc);
+            p = jmp_to(p, jit->dispatch);
+            break;
+        }
+
+        Um_decoded inst = decode_instr(segment_zero[pc]);
+        int a = UMREG(inst.a);
+        int b = UMREG(inst.b);
+        int c = UMREG(inst.c);
+        uint8_t *to_normal, *to_done;
+
+        switch (inst.handler) {
+            case CMOV:
+                p = op_rr(p, 0x85, c, c);                   /* test c,c */
+                p = op_0f_rr(p, 0x45, a, b);                /* cmovne a,b */
+                break;
+            case SLOAD:
+                p = op_rr(p, 0x89, b, RAX);                 /* mov eax,b */
+                p = op_state(p, 0, 0x3b, RAX, STATE(num_segments));
+                p = jcc(p, CC_AE, &fixups[num_fixups++], pc);
+                p = op_state(p, 1, 0x8b, RSI, STATE(segments));
+                p = op_sib(p, 1, 0x8b, RSI, RSI, RAX, 3);
+                p = test_sil_1(p);               /* unmapped slot */
+                p = jcc(p, CC_NE, &fixups[num_fixups++], pc);
+                p = op_disp8(p, 0, 0x3b, c, RSI, -4);  /* cmp c,[rsi-4] */
+                p = jcc(p, CC_AE, &fixups[num_fixups++], pc);
+                p = op_rr(p, 0x89, c, RCX);                 /* mov ecx,c */
+                p = op_sib(p, 0, 0x8b, a, RSI, RCX, 2);     /* mov a,[..] */
+                break;
+            case SSTORE:
+                p = op_rr(p, 0x85, a, a);                   /* test a,a */
+                p = jcc_to(p, CC_NE, p);
+                to_normal = p - 4;
+
+                /* Segment 0: plain store unless the word was compiled or
+                   is still shared with the segment it was loaded from */
+                p = op_state(p, 0, 0x83, 7, STATE(zero_shared));
+                p = emit8(p, 0);                            /* cmp shared,0 */
+                p = jcc(p, CC_NE, &fixups[num_fixups++], pc);
+                p = op_state(p, 0, 0x3b, b, STATE(zero_length));
+                p = jcc(p, CC_AE, &fixups[num_fixups++], pc);
+                p = op_state(p, 1, 0x8b, RCX, STATE(covered));
+                p = op_rr(p, 0x89, b, RAX);                 /* mov eax,b */
+                p = op_sib(p, 0, 0x80, 7, RCX, RAX, 0);  /* cmp [rcx+rax],0 */
+                p = emit8(p, 0);
+                p = jcc(p, CC_NE, &fixups[num_fixups++], pc);
+                p = op_state(p, 1, 0x8b, RSI, STATE(segments));
+                p = emit8(emit8(emit8(p, 0x48), 0x8b), 0x36);  /* rsi=[rsi] */
+                p = op_sib(p, 0, 0x89, c, RSI, RAX, 2);     /* mov [..],c */
+                p = jmp_to(p, p);
+                to_done = p - 4;
+
+                /* Any other segment */
+                patch(to_normal, p);
+                p = op_rr(p, 0x89, a, RAX);                 /* mov eax,a */
+                p = op_state(p, 0, 0x3b, RAX, STATE(zero_shared));
+                p = jcc(p, CC_E, &fixups[num_fixups++], pc);
+                p = op_state(p, 0, 0x3b, RAX, STATE(num_segments));
+                p = jcc(p, CC_AE, &fixups[num_fixups++], pc);
+                p = op_state(p, 1, 0x8b, RSI, STATE(segments));
+                p = op_sib(p, 1, 0x8b, RSI, RSI, RAX, 3);
+                p = test_sil_1(p);               /* unmapped slot */
+                p = jcc(p, CC_NE, &fixups[num_fixups++], pc);
+                p = op_disp8(p, 0, 0x3b, b, RSI, -4);  /* cmp b,[rsi-4] */
+                p = jcc(p, CC_AE, &fixups[num_fixups++], pc);
+                p = op_rr(p, 0x89, b, RCX);                 /* mov ecx,b */
+                p = op_sib(p, 0, 0x89, c, RSI, RCX, 2);     /* mov [..],c */
+                patch(to_done, p);
+                break;
+            case ADD:
+                p = op_rr(p, 0x89, b, RAX);
+                p = op_rr(p, 0x01, c, RAX);                 /* add eax,c */
+                p = op_rr(p, 0x89, RAX, a);
+                break;
+            case MUL:
+                p = op_rr(p, 0x89, b, RAX);
+                p = op_0f_rr(p, 0xaf, RAX, c);              /* imul eax,c */
+                p = op_rr(p, 0x89, RAX, a);
+                break;
+            case DIV:
+                p = op_rr(p, 0x85, c, c);
+                p = jcc(p, CC_E, &fixups[num_fixups++], pc);
+                p = op_rr(p, 0x89, b, RAX);
+                p = op_rr(p, 0x31, RDX, RDX);
+                p = op_f7(p, 6, c);                         /* div c */
+                p = op_rr(p, 0x89, RAX, a);
+                break;
+            case NAND:
+                p = op_rr(p, 0x89, b, RAX);
+                p = op_rr(p, 0x21, c, RAX);                 /* and eax,c */
+                p = op_f7(p, 2, RAX);                       /* not eax */
+                p = op_rr(p, 0x89, RAX, a);
+                break;
+            case ACTIVATE:
+            case INACTIVATE:
+            case OUT:
+            case IN:
+                p = mov_imm(p, RAX, pc);
+                p = call_to(p, jit->callout);
+                p = op_rr(p, 0x85, RAX, RAX);
+                p = jcc_to(p, CC_E, jit->exit_resume);
+                break;
+            case LV:
+                p = mov_imm(p, a, inst.imm);
+                break;
+            case LOADP:
+                p = op_rr(p, 0x85, b, b);     /* other segment: interpreter */
+                p = jcc(p, CC_NE, &fixups[num_fixups++], pc);
+                p = op_rr(p, 0x89, c, RAX);
+                p = jmp_to(p, jit->dispatch);
+                done = 1;
+                break;
+            default:
+                /* Halt and invalid opcodes: left to the interpreter */
+                p = mov_imm(p, RAX, pc);
+                p = jmp_to(p, jit->exit_step);
+                done = 1;
+                pc--;
+                break;
+        }
+        pc++;
+    }
+
+    /* Side exits: hand the instruction at fixup.pc to the interpreter */
+    for (int i = 0; i < num_fixups; i++) {
+        if (i == 0 || fixups[i].pc != fixups[i - 1].pc) {
+            uint8_t *stub = p;
+            p = mov_imm(p, RAX, fixups[i].pc);
+            p = jmp_to(p, jit->exit_step);
+            for (int j = i; j < num_fixups && fixups[j].pc == fixups[i].pc;
+                 j++) {
+                patch(fixups[j].at, stub);
+            }
+        }
+    }
+
+    jit->arena_used = (p - jit->arena + 15) & ~(size_t)15;
+    jit->state.blocks[start] = block;
+    jit->block_end[start] = pc;
+    jit->starts[jit->num_starts++] = start;
+    memset(jit->state.covered + start, 1, pc - start);
+
+    return block;
+}
+
+/************************** x86-64 Encoding **********************************/
+
+uint8_t *emit8(uint8_t *p, uint8_t byte)
+{
+    *p = byte;
+    return p + 1;
+}
+
+uint8_t *emit32(uint8_t *p, uint32_t value)
+{
+    memcpy(p, &value, 4);
+    return p + 4;
+}
+
+/* REX prefix, left out when it would be empty */
+uint8_t *rex(uint8_t *p, int w, int reg, int index, int base)
+{
+    uint8_t prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) |
+                     ((index >> 3) << 1) | (base >> 3);
+    if (prefix != 0x40) {
+        p = emit8(p, prefix);
+    }
+    return p;
+}
+
+/* 32-bit "opcode r/m, reg" between registers: mov, add, and, xor, test */
+uint8_t *op_rr(uint8_t *p, uint8_t opcode, int reg, int rm)
+{
+    p = rex(p, 0, reg, 0, rm);
+    p = emit8(p, opcode);
+    return emit8(p, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* 64-bit "opcode r/m, reg" between registers: mov, or */
+uint8_t *op_rr64(uint8_t *p, uint8_t opcode, int reg, int rm)
+{
+    p = rex(p, 1, reg, 0, rm);
+    p = emit8(p, opcode);
+    return emit8(p, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* 32-bit "0f opcode reg, r/m" between registers: imul, cmovne */
+uint8_t *op_0f_rr(uint8_t *p, uint8_t opcode, int reg, int rm)
+{
+    p = rex(p, 0, reg, 0, rm);
+    p = emit8(emit8(p, 0x0f), opcode);
+    return emit8(p, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* 32-bit group 3 on a register: not (ext 2), div (ext 6) */
+uint8_t *op_f7(uint8_t *p, int ext, int rm)
+{
+    p = rex(p, 0, 0, 0, rm);
+    p = emit8(p, 0xf7);
+    return emit8(p, 0xc0 | (ext << 3) | (rm & 7));
+}
+
+/* mov reg32, imm32 */
+uint8_t *mov_imm(uint8_t *p, int reg, uint32_t imm)
+{
+    p = rex(p, 0, 0, 0, reg);
+    p = emit8(p, 0xb8 + (reg & 7));
+    return emit32(p, imm);
+}
+
+/* "opcode reg, [rbx + offset]" on a Jit_state field */
+uint8_t *op_state(uint8_t *p, int w, uint8_t opcode, int reg, size_t offset)
+{
+    return op_disp8(p, w, opcode, reg, RBX, offset);
+}
+
+/* "opcode reg, [base + disp]"; base must not be rsp or r12 */
+uint8_t *op_disp8(uint8_t *p, int w, uint8_t opcode, int reg, int base,
+                  int8_t disp)
+{
+    p = rex(p, w, reg, 0, base);
+    p = emit8(p, opcode);
+    p = emit8(p, 0x40 | ((reg & 7) << 3) | (base & 7));
+    return emit8(p, (uint8_t)disp);
+}
+
+/* "opcode reg, [base + index * 2^scale]"; base must not be rbp or r13 */
+uint8_t *op_sib(uint8_t *p, int w, uint8_t opcode, int reg, int base,
+                int index, int scale)
+{
+    p = rex(p, w, reg, index, base);
+    p = emit8(p, opcode);
+    p = emit8(p, ((reg & 7) << 3) | 0x04);
+    return emit8(p, (scale << 6) | ((index & 7) << 3) | (base & 7));
+}
+
+/* test reg64, reg64 */
+uint8_t *test64(uint8_t *p, int reg)
+{
+    p = rex(p, 1, reg, 0, reg);
+    p = emit8(p, 0x85);
+    return emit8(p, 0xc0 | ((reg & 7) << 3) | (reg & 7));
+}
+
+/* test sil, 1 */
+uint8_t *test_sil_1(uint8_t *p)
+{
+    p = emit8(emit8(p, 0x40), 0xf6);
+    return emit8(emit8(p, 0xc6), 0x01);
+}
+
+/* Stores r8d-r15d into the UM's registers; clobbers rcx */
+uint8_t *save_registers(uint8_t *p)
+{
+    p = op_state(p, 1, 0x8b, RCX, STATE(registers));
+    for (int i = 0; i < 8; i++) {                  /* mov [rcx+4i],r(8+i)d */
+        p = rex(p, 0, UMREG(i), 0, RCX);
+        p = emit8(emit8(p, 0x89), 0x40 | ((UMREG(i) & 7) << 3) | RCX);
+        p = emit8(p, 4 * i);
+    }
+    return p;
+}
+
+/* Loads r8d-r15d from the UM's registers; clobbers rcx */
+uint8_t *load_registers(uint8_t *p)
+{
+    p = op_state(p, 1, 0x8b, RCX, STATE(registers));
+    for (int i = 0; i < 8; i++) {                  /* mov r(8+i)d,[rcx+4i] */
+        p = rex(p, 0, UMREG(i), 0, RCX);
+        p = emit8(emit8(p, 0x8b), 0x40 | ((UMREG(i) & 7) << 3) | RCX);
+        p = emit8(p, 4 * i);
+    }
+    return p;
+}
+
+/* jcc rel32 to a side exit, patched once the block is done */
+uint8_t *jcc(uint8_t *p, int cc, Jit_fixup *fixup, uint32_t pc)
+{
+    p = emit8(emit8(p, 0x0f), 0x80 | cc);
+    fixup->at = p;
+    fixup->pc = pc;
+    return emit32(p, 0);
+}
+
+/* jcc rel32 */
+uint8_t *jcc_to(uint8_t *p, int cc, uint8_t *target)
+{
+    p = emit8(emit8(p, 0x0f), 0x80 | cc);
+    return emit32(p, target - (p + 4));
+}
+
+/* jmp rel32 */
+uint8_t *jmp_to(uint8_t *p, uint8_t *target)
+{
+    p = emit8(p, 0xe9);
+    return emit32(p, target - (p + 4));
+}
+
+/* call rel32 */
+uint8_t *call_to(uint8_t *p, uint8_t *target)
+{
+    p = emit8(p, 0xe8);
+    return emit32(p, target - (p + 4));
+}
+
+/* Points the rel32 at "at" to target */
+void patch(uint8_t *at, uint8_t *target)
+{
+    uint32_t rel = target - (at + 4);
+    memcpy(at, &rel, 4);
+}
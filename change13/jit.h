@@ -0,0 +1,14 @@
+/* jit.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Interface of the x86-64 baseline JIT for segment 0.
+ */
+
+#ifndef JIT_H_INCLUDED
+#define JIT_H_INCLUDED
+
+#include "umInstructions.h"
+
+void jit_execute(UM um);
+
+#endif
@@ -0,0 +1,108 @@
+/* outputBuffer.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Buffer behind the UM's output instruction.
+ *
+ * Output bytes are collected here and handed to standard output with one
+ * write() when the buffer fills, before the UM waits for input (so a prompt
+ * is on the screen before the program waits for its answer), at halt, and
+ * at exit, so output printed before a failure mode is not lost. The null
+ * sink throws every flush away, leaving the cost of the UM alone.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include "assert.h"
+#include "outputBuffer.h"
+
+#define DEFAULT_SIZE (64 * 1024)
+
+struct Output_buffer output_buffer;
+
+static int null_sink;  /* 1 to discard the output */
+static int exiting;    /* 1 once exit has started */
+
+/********************* Private Function Declarations *************************/
+static void flush_at_exit();
+
+/************************** Function Definitions *****************************/
+
+/*
+ * output_buffer_init
+ * Description:
+ * - Sets up the output buffer; called once before the UM runs
+ * Parameters:
+ * - Size of the buffer in bytes, 0 for the default (size_t size)
+ * - 1 to discard all output instead of writing it (int discard)
+ * Effects:
+ * - Allocates the buffer and flushes it again when the process exits
+ * Returns:
+ * - None
+ */
+void output_buffer_init(size_t size, int discard)
+{
+    if (size == 0) {
+        size = DEFAULT_SIZE;
+    }
+    output_buffer.bytes = malloc(size);
+    assert(output_buffer.bytes != NULL);
+    output_buffer.used = 0;
+    output_buffer.size = size;
+    null_sink = discard;
+    atexit(flush_at_exit);
+}
+
+/*
+ * output_buffer_flush
+ * Description:
+ * - Writes out everything in the output buffer
+ * Parameters:
+ * - None
+ * Effects:
+ * - Empties the buffer; exits if standard output can't be written
+ * Returns:
+ * - None
+ */
+void output_buffer_flush()
+{
+    size_t done = 0;
+    while (!null_sink && done < output_buffer.used) {
+        ssize_t written = write(STDOUT_FILENO, output_buffer.bytes + done,
+                                output_buffer.used - done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            output_buffer.used = 0;
+            fprintf(stderr, "Cannot write output\n");
+            if (exiting) {
+                return;
+            }
+            exit(EXIT_FAILURE);
+        }
+        done += written;
+    }
+    output_buffer.used = 0;
+}
+
+/************************** Helper Functions *********************************/
+
+/*
+ * flush_at_exit
+ * Description:
+ * - Flushes what is left in the buffer, for atexit
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+void flush_at_exit()
+{
+    exiting = 1;
+    output_buffer_flush();
+    free(output_buffer.bytes);
+    output_buffer.bytes = NULL;
+    output_buffer.size = 0;
+}
@@ -0,0 +1,34 @@
+/* outputBuffer.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Interface of the buffer behind the UM's output instruction.
+ */
+
+#ifndef OUTPUTBUFFER_H_INCLUDED
+#define OUTPUTBUFFER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bytes output since the last flush; use output_buffer_put */
+struct Output_buffer {
+    uint8_t *bytes;
+    size_t used;
+    size_t size;
+};
+
+extern struct Output_buffer output_buffer;
+
+void output_buffer_init(size_t size, int discard);
+void output_buffer_flush();
+
+/* Appends one byte of output, flushing first if the buffer is full */
+static inline void output_buffer_put(uint8_t c)
+{
+    if (output_buffer.used == output_buffer.size) {
+        output_buffer_flush();
+    }
+    output_buffer.bytes[output_buffer.used++] = c;
+}
+
+#endif
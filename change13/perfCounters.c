@@ -0,0 +1,200 @@
+/* perfCounters.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Hardware performance counters behind --perf.
+ *
+ * perf_counters_start opens one perf_event_open counter per event in
+ * events, counting this process in user mode only, and enables them just
+ * before the UM runs; perf_counters_stop disables them as the halt 
+ * instruction starts, before the UM's memory is freed. If the UM fails 
+ * instead, the counts are reported as the process exits. Each
+ * counter is opened on its own rather than as a group, so an event the CPU
+ * (or a virtual machine) doesn't have is reported as not counted without
+ * losing the others, and a counter the kernel had to share with others is
+ * scaled up by the time it was enabled over the time it ran, as perf stat
+ * does.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfCounters.h"
+
+/* A cache event: which cache, reads, misses */
+#define CACHE_READ_MISSES(cache) ((cache) |                          \
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |                          \
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} events[] = {
+    { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "L1d misses",    PERF_TYPE_HW_CACHE,
+                       CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1D) },
+    { "LLC misses",    PERF_TYPE_HW_CACHE,
+                       CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_LL) },
+    { "dTLB misses",   PERF_TYPE_HW_CACHE,
+                       CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_DTLB) },
+};
+
+#define NUM_EVENTS (sizeof(events) / sizeof(events[0]))
+
+/* What read() gives with the format perf_counters_start asks for */
+typedef struct Counter_value {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+} Counter_value;
+
+static int fds[NUM_EVENTS];     /* -1 if the event couldn't be opened */
+static int open_errors[NUM_EVENTS]; /* errno of the failed open */
+static int counting;            /* started and not stopped yet */
+static int reported;            /* perf_counters_report has run */
+
+/********************* Private Function Declarations *************************/
+static void report_at_exit();
+
+/************************** Function Definitions *****************************/
+
+/*
+ * perf_counters_start
+ * Description:
+ * - Opens and starts every counter
+ * Parameters:
+ * - None
+ * Effects:
+ * - Counters the kernel refuses are left out of the count, not fatal; 
+ *   the counts are reported at exit unless perf_counters_report has 
+ *   been called by then
+ * Returns:
+ * - None
+ */
+void perf_counters_start()
+{
+    atexit(report_at_exit);
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        open_errors[i] = fds[i] < 0 ? errno : 0;
+    }
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    counting = 1;
+}
+
+/*
+ * perf_counters_stop
+ * Description:
+ * - Stops every counter, as soon as the UM halts
+ * Parameters:
+ * - None
+ * Effects:
+ * - Does nothing if the counters aren't running, so the halt instruction
+ *   can call it with or without --perf
+ * Returns:
+ * - None
+ */
+void perf_counters_stop()
+{
+    if (!counting) {
+        return;
+    }
+    counting = 0;
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+/*
+ * perf_counters_report
+ * Description:
+ * - Prints each count for the run, and per million UM instructions when
+ *   their number is known
+ * Parameters:
+ * - Where to print (FILE *out)
+ * - UM instructions executed, 0 if not counted (uint64_t um_instructions)
+ * Effects:
+ * - Closes the counters
+ * Returns:
+ * - None
+ */
+void perf_counters_report(FILE *out, uint64_t um_instructions)
+{
+    reported = 1;
+    fprintf(out, "perf (user mode, while the UM ran):\n");
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+        Counter_value counter;
+        if (fds[i] < 0) {
+            fprintf(out, "  %-14s not counted (%s)\n", events[i].name,
+                    strerror(open_errors[i]));
+            continue;
+        }
+        if (read(fds[i], &counter, sizeof(counter)) != sizeof(counter) ||
+            counter.time_running == 0) {
+            fprintf(out, "  %-14s not counted\n", events[i].name);
+            close(fds[i]);
+            continue;
+        }
+        close(fds[i]);
+
+        double value = counter.value;
+        if (counter.time_running < counter.time_enabled) {
+            value *= (double)counter.time_enabled / counter.time_running;
+        }
+        fprintf(out, "  %-14s %16.0f", events[i].name, value);
+        if (um_instructions != 0) {
+            fprintf(out, "  %12.1f per million UM instructions",
+                    value * 1e6 / um_instructions);
+        }
+        if (counter.time_running < counter.time_enabled) {
+            fprintf(out, "  (scaled, counted %.0f%% of the time)",
+                    100.0 * counter.time_running / counter.time_enabled);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+/************************** Helper Functions *********************************/
+
+/*
+ * report_at_exit
+ * Description:
+ * - Reports the counts of a UM that failed instead of halting, for atexit
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+void report_at_exit()
+{
+    if (reported) {
+        return;
+    }
+    perf_counters_stop();
+    perf_counters_report(stderr, 0);
+}
@@ -0,0 +1,17 @@
+/* perfCounters.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Interface of the hardware performance counters behind --perf.
+ */
+
+#ifndef PERFCOUNTERS_H_INCLUDED
+#define PERFCOUNTERS_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+void perf_counters_start();
+void perf_counters_stop();
+void perf_counters_report(FILE *out, uint64_t um_instructions);
+
+#endif
@@ -0,0 +1,414 @@
+/* profiler.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Sampling profiler behind --profile=FILE.
+ *
+ * A timer on the process's CPU time (ITIMER_PROF) sets profile_tick every
+ * SAMPLE_INTERVAL_US microseconds, or every tick of the kernel's clock if
+ * that is longer (4 ms with HZ=250). The profiling cycle checks it after
+ * each instruction and calls profile_sample with the next word to run,
+ * which is recorded along with the target of the load program that
+ * entered the code it is in and the program in segment 0 (0 for the one
+ * the UM started with, one more for every load of another segment). At halt,
+ * profile_finish prints the hottest words, RANGE_WORDS-word ranges and load
+ * program targets, and writes every sample to FILE as folded stacks, one
+ * line per program, target and word with its number of samples:
+ *     program0;entry_000004d2;pc_000004e0 37
+ * which flamegraph.pl and the tools like it read as is.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include "assert.h"
+#include "profiler.h"
+
+#define SAMPLE_INTERVAL_US 1000
+#define RANGE_WORDS 64       /* words per range in the report */
+#define TOP_SAMPLED 10       /* lines per list in the report */
+#define INITIAL_SLOTS 1024   /* slots in the sample table, a power of two */
+
+/* Samples of one word entered from one load program target */
+typedef struct Sample {
+    uint32_t program; /* which program segment 0 held */
+    uint32_t entry;   /* load program target the word was reached from */
+    uint32_t pc;
+    uint64_t count;   /* 0 for an empty slot */
+} Sample;
+
+/* What one of the report's lists counts samples by */
+typedef enum Profile_key { BY_WORD, BY_RANGE, BY_ENTRY } Profile_key;
+
+volatile sig_atomic_t profile_tick;
+
+static Sample *table;   /* open addressing, probed linearly */
+static size_t capacity; /* slots in table */
+static size_t used;     /* slots in use */
+static uint64_t total;  /* samples taken */
+static uint32_t program;
+static uint32_t entry;
+static double started;  /* CPU time at profile_start, in seconds */
+static FILE *folded;
+static char *folded_name;
+
+/********************* Private Function Declarations *************************/
+static void on_timer(int signal);
+static void set_timer(long microseconds);
+static double cpu_seconds();
+static Sample *slot_for(uint32_t program, uint32_t entry, uint32_t pc);
+static void grow_table();
+static void report_hottest(FILE *out, const char *title, Profile_key key);
+static int compare_by_key(const void *a, const void *b);
+static int compare_by_count(const void *a, const void *b);
+
+/************************** Function Definitions *****************************/
+
+/*
+ * profile_start
+ * Description:
+ * - Starts sampling; called once, before the UM runs
+ * Parameters:
+ * - File to write the folded stacks to at halt (char *filename)
+ * - The word the UM starts at, the first entry (uint32_t pc)
+ * Effects:
+ * - Creates the file and starts the timer; exits if the file can't be
+ *   created
+ * Returns:
+ * - None
+ */
+void profile_start(char *filename, uint32_t pc)
+{
+    folded = fopen(filename, "w");
+    if (folded == NULL) {
+        fprintf(stderr, "Cannot write profile %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    folded_name = filename;
+
+    capacity = INITIAL_SLOTS;
+    table = calloc(capacity, sizeof(Sample));
+    assert(table != NULL);
+    used = 0;
+    total = 0;
+    program = 0;
+    entry = pc;
+    started = cpu_seconds();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_timer;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    set_timer(SAMPLE_INTERVAL_US);
+}
+
+/*
+ * profile_sample
+ * Description:
+ * - Records one sample, once profile_tick is set
+ * Parameters:
+ * - The next word of segment 0 the UM runs (uint32_t pc)
+ * Effects:
+ * - Clears profile_tick
+ * Returns:
+ * - None
+ */
+void profile_sample(uint32_t pc)
+{
+    profile_tick = 0;
+    slot_for(program, entry, pc)->count++;
+    total++;
+}
+
+/*
+ * profile_entered
+ * Description:
+ * - Notes a load program, whose target the samples that follow are
+ *   attributed to
+ * Parameters:
+ * - The word jumped to (uint32_t pc)
+ * Returns:
+ * - None
+ */
+void profile_entered(uint32_t pc)
+{
+    entry = pc;
+}
+
+/*
+ * profile_new_program
+ * Description:
+ * - Notes that a load program replaced segment 0 with another segment
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+void profile_new_program()
+{
+    program++;
+}
+
+/*
+ * profile_finish
+ * Description:
+ * - Stops sampling, writes the folded stacks and prints the report
+ * Parameters:
+ * - Where to print the report (FILE *out)
+ * Effects:
+ * - Frees the samples; exits if the folded stacks can't be written
+ * Returns:
+ * - None
+ */
+void profile_finish(FILE *out)
+{
+    set_timer(0);
+
+    Sample *samples = malloc((used + 1) * sizeof(Sample));
+    assert(samples != NULL);
+    size_t count = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        if (table[i].count != 0) {
+            samples[count++] = table[i];
+        }
+    }
+    qsort(samples, count, sizeof(Sample), compare_by_key);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(folded, "program%u;entry_%08x;pc_%08x %llu\n",
+                samples[i].program, samples[i].entry, samples[i].pc,
+                (unsigned long long)samples[i].count);
+    }
+    free(samples);
+    if (fclose(folded) != 0) {
+        fprintf(stderr, "Cannot write profile %s\n", folded_name);
+        exit(EXIT_FAILURE);
+    }
+    folded = NULL;
+
+    fprintf(out, "profile: %llu samples in %.2f s of CPU time; folded "
+            "stacks in %s\n", (unsigned long long)total, 
+            cpu_seconds() - started, folded_name);
+    report_hottest(out, "hottest words:", BY_WORD);
+    report_hottest(out, "hottest ranges:", BY_RANGE);
+    report_hottest(out, "hottest load program targets:", BY_ENTRY);
+
+    free(table);
+    table = NULL;
+    capacity = used = 0;
+}
+
+/************************** Helper Functions *********************************/
+
+/*
+ * on_timer
+ * Description:
+ * - SIGPROF handler: asks the cycle for a sample
+ * Parameters:
+ * - The signal (int signal)
+ * Returns:
+ * - None
+ */
+void on_timer(int signal)
+{
+    (void) signal;
+    profile_tick = 1;
+}
+
+/*
+ * set_timer
+ * Description:
+ * - Sets the profiling timer
+ * Parameters:
+ * - Microseconds of CPU time between samples, 0 to stop
+ *   (long microseconds)
+ * Returns:
+ * - None
+ */
+void set_timer(long microseconds)
+{
+    struct itimerval timer;
+    timer.it_interval.tv_sec = microseconds / 1000000;
+    timer.it_interval.tv_usec = microseconds % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/*
+ * cpu_seconds
+ * Description:
+ * - Reads the CPU time the process has used
+ * Parameters:
+ * - None
+ * Returns:
+ * - The time in seconds (double)
+ */
+double cpu_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * slot_for
+ * Description:
+ * - Finds the samples of a word reached from a target, adding them if
+ *   there are none yet
+ * Parameters:
+ * - Program, load program target and word (uint32_t program,
+ *   uint32_t entry, uint32_t pc)
+ * Effects:
+ * - May grow the table, moving every slot
+ * Returns:
+ * - The slot (Sample *)
+ */
+Sample *slot_for(uint32_t program, uint32_t entry, uint32_t pc)
+{
+    if (2 * (used + 1) > capacity) {
+        grow_table();
+    }
+
+    uint32_t hash = (program * 0x9e3779b1u) ^ (entry * 0x85ebca77u) ^
+                    (pc * 0xc2b2ae3du);
+    size_t i = (hash ^ (hash >> 15)) & (capacity - 1);
+    while (table[i].count != 0) {
+        if (table[i].pc == pc && table[i].entry == entry &&
+            table[i].program == program) {
+            return &table[i];
+        }
+        i = (i + 1) & (capacity - 1);
+    }
+
+    table[i].program = program;
+    table[i].entry = entry;
+    table[i].pc = pc;
+    used++;
+    return &table[i];
+}
+
+/*
+ * grow_table
+ * Description:
+ * - Doubles the sample table
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+void grow_table()
+{
+    Sample *old = table;
+    size_t old_capacity = capacity;
+
+    capacity *= 2;
+    table = calloc(capacity, sizeof(Sample));
+    assert(table != NULL);
+    used = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].count != 0) {
+            slot_for(old[i].program, old[i].entry, old[i].pc)->count =
+                old[i].count;
+        }
+    }
+    free(old);
+}
+
+/*
+ * report_hottest
+ * Description:
+ * - Prints the TOP_SAMPLED words, ranges or load program targets with the
+ *   most samples
+ * Parameters:
+ * - Where to print (FILE *out)
+ * - Heading of the list (const char *title)
+ * - What to count the samples by (Profile_key key)
+ * Returns:
+ * - None
+ */
+void report_hottest(FILE *out, const char *title, Profile_key key)
+{
+    /* Each sample's key goes in pc, with entry cleared, so samples of the
+       same key sort together and merge */
+    Sample *samples = malloc((used + 1) * sizeof(Sample));
+    assert(samples != NULL);
+    size_t count = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        if (table[i].count != 0) {
+            Sample sample = table[i];
+            sample.pc = key == BY_WORD  ? sample.pc :
+                        key == BY_RANGE ? sample.pc / RANGE_WORDS :
+                                          sample.entry;
+            sample.entry = 0;
+            samples[count++] = sample;
+        }
+    }
+    qsort(samples, count, sizeof(Sample), compare_by_key);
+
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (merged > 0 && samples[merged - 1].program == samples[i].program &&
+            samples[merged - 1].pc == samples[i].pc) {
+            samples[merged - 1].count += samples[i].count;
+        } else {
+            samples[merged++] = samples[i];
+        }
+    }
+    qsort(samples, merged, sizeof(Sample), compare_by_count);
+
+    fprintf(out, "%s\n", title);
+    for (size_t i = 0; i < merged && i < TOP_SAMPLED; i++) {
+        char where[32];
+        if (key == BY_RANGE) {
+            snprintf(where, sizeof(where), "%08x-%08x",
+                     samples[i].pc * RANGE_WORDS,
+                     samples[i].pc * RANGE_WORDS + RANGE_WORDS - 1);
+        } else {
+            snprintf(where, sizeof(where), "%08x", samples[i].pc);
+        }
+        fprintf(out, "  program%-3u %-17s %12llu  %5.1f%%\n",
+                samples[i].program, where,
+                (unsigned long long)samples[i].count,
+                100.0 * samples[i].count / total);
+    }
+    free(samples);
+}
+
+/*
+ * compare_by_key
+ * Description:
+ * - Orders samples by program, then entry, then word, for qsort
+ * Parameters:
+ * - Two pointers to samples (const void *a, const void *b)
+ * Returns:
+ * - Negative if a comes first, positive if b does, else 0
+ */
+int compare_by_key(const void *a, const void *b)
+{
+    const Sample *x = a, *y = b;
+    if (x->program != y->program) {
+        return x->program < y->program ? -1 : 1;
+    }
+    if (x->entry != y->entry) {
+        return x->entry < y->entry ? -1 : 1;
+    }
+    return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+/*
+ * compare_by_count
+ * Description:
+ * - Orders samples from the most down, for qsort
+ * Parameters:
+ * - Two pointers to samples (const void *a, const void *b)
+ * Returns:
+ * - Negative if a has more, positive if b has, else 0
+ */
+int compare_by_count(const void *a, const void *b)
+{
+    uint64_t x = ((const Sample *)a)->count;
+    uint64_t y = ((const Sample *)b)->count;
+    return (x < y) - (x > y);
+}
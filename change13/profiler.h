@@ -0,0 +1,23 @@
+/* profiler.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Interface of the sampling profiler behind --profile.
+ */
+
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+
+/* Set by the profiling timer; the cycle calls profile_sample when it is */
+extern volatile sig_atomic_t profile_tick;
+
+void profile_start(char *filename, uint32_t pc);
+void profile_sample(uint32_t pc);
+void profile_entered(uint32_t pc);
+void profile_new_program();
+void profile_finish(FILE *out);
+
+#endif
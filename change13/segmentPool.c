@@ -0,0 +1,419 @@
+/* segmentPool.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Allocator behind every segment of the UM.
+ *
+ * Every segment is preceded by a header word holding its length, so a
+ * single pointer gives both the bounds and the words (segment_length).
+ * A segment that fits in 2^MAX_CLASS words, header included, is rounded up
+ * to a power of two and comes off the free list of that size class when one
+ * has been returned; only an empty list costs a malloc. Larger segments get
+ * pages of their own from mmap (2 MB aligned huge pages with --huge-pages,
+ * see hugePages.c), which come zeroed by the kernel as they are first
+ * touched, so mapping a big segment that is only written sparsely
+ * costs neither the memset nor the memory; munmap gives them back. A
+ * segment on a free list holds the link to the next one in its first two
+ * words, so the smallest class is two words.
+ *
+ * Built with make SEGMENTS=arena, every segment comes out of one arena of
+ * 2^32 words reserved up front (segment_arena). A segment's ID is its word
+ * offset in the arena (arena_map), so the UM finds it with an add instead
+ * of a table lookup, and the byte of that offset in arena_mapped, a map
+ * beside the arena that the program can't write, tells whether a mapped
+ * segment starts there. Blocks of every size are rounded up to a power of
+ * two and carved off the end of the arena; a returned block goes on the
+ * free list of its class, linked by the arena offset of the next one in
+ * its length word, and is never given back to the system until
+ * segment_pool_free. A large block's whole pages
+ * are given back with madvise(MADV_DONTNEED) when it is returned, so they
+ * read as 0 again, and only the partial pages at its ends are memset.
+ * With --huge-pages the whole arena is marked MADV_HUGEPAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "assert.h"
+#include "hugePages.h"
+#include "segmentPool.h"
+
+#define MIN_CLASS 1    /* 2 words, room for the free list link */
+#define SMALL_CLASS 16 /* 65536 words with the header; bigger is large */
+#define PAGE_BYTES 4096
+
+#ifdef ARENA_SEGMENTS
+
+#define HEADER_WORDS 1  /* length */
+#define MAX_CLASS 32    /* 2^32 - 1 words and the header */
+#define ARENA_WORDS (1ull << 32)
+#define ARENA_START 16  /* block offsets before this are free list ends */
+
+#define ARENA_BYTES (ARENA_WORDS * sizeof(uint32_t))
+#define MAPPED_BYTES ARENA_WORDS
+
+uint32_t *segment_arena;
+uint8_t *arena_mapped;
+
+static uint32_t free_offsets[MAX_CLASS + 1]; /* 0 if the list is empty */
+static uint64_t arena_used = ARENA_START;    /* words carved off so far */
+#else
+#define HEADER_WORDS 1  /* length */
+#define MAX_CLASS SMALL_CLASS
+#endif
+
+typedef struct Free_segment {
+    struct Free_segment *next;
+} Free_segment;
+
+static Free_segment *free_lists[MAX_CLASS + 1];
+
+/* Reported by segment_pool_report */
+static struct {
+    uint64_t hits;        /* small segments recycled from a free list */
+    uint64_t misses;      /* small segments that needed a malloc */
+    uint64_t large;       /* large segments, always mmap'd */
+    uint64_t returned;    /* small segments put back on a free list */
+    uint64_t large_freed; /* large segments given back to munmap */
+} stats;
+
+/********************* Private Function Declarations *************************/
+static inline int size_class(size_t words);
+static inline uint32_t *take(uint32_t words);
+static inline size_t large_bytes(uint32_t words);
+#ifdef ARENA_SEGMENTS
+static inline uint32_t *arena_take(int class);
+static void arena_reserve();
+static void clear_ends(uint32_t *start, uint32_t *end);
+#endif
+
+/************************** Function Definitions *****************************/
+
+/*
+ * segment_pool_get
+ * Description:
+ * - Allocates a segment whose words are all 0
+ * Parameters:
+ * - Number of words in the segment (uint32_t words)
+ * Effects:
+ * - Recycles a segment of the same size class if one is free
+ * Returns:
+ * - The segment (uint32_t *), segment_length(segment) == words; release it
+ *   with segment_pool_put
+ */
+uint32_t *segment_pool_get(uint32_t words)
+{
+    uint32_t *segment = take(words);
+
+    /* The pages of a large segment are zero until first written */
+    if (size_class((size_t)words + HEADER_WORDS) > SMALL_CLASS) {
+#ifdef ARENA_SEGMENTS
+        clear_ends(segment, segment + words);
+#endif
+        return segment;
+    }
+    memset(segment, 0, (size_t)words * sizeof(uint32_t));
+
+    return segment;
+}
+
+/*
+ * segment_pool_copy
+ * Description:
+ * - Allocates a segment holding a copy of another
+ * Parameters:
+ * - The segment to copy (const uint32_t *segment)
+ * Returns:
+ * - The copy (uint32_t *); release it with segment_pool_put
+ */
+uint32_t *segment_pool_copy(const uint32_t *segment)
+{
+    uint32_t words = segment_length(segment);
+    uint32_t *copy = take(words);
+    memcpy(copy, segment, (size_t)words * sizeof(uint32_t));
+    return copy;
+}
+
+/*
+ * segment_pool_put
+ * Description:
+ * - Releases a segment from segment_pool_get or segment_pool_copy
+ * Parameters:
+ * - The segment (uint32_t *segment); NULL is ignored
+ * Effects:
+ * - Small segments go on the free list of their size class, large ones are
+ *   unmapped (with SEGMENTS=arena, their pages are given back and the
+ *   block goes on its free list)
+ * Returns:
+ * - None
+ */
+void segment_pool_put(uint32_t *segment)
+{
+    if (segment == NULL) {
+        return;
+    }
+
+    uint32_t *block = segment - HEADER_WORDS;
+    int class = size_class((size_t)segment_length(segment) + HEADER_WORDS);
+#ifdef ARENA_SEGMENTS
+    if (class > SMALL_CLASS) {
+        uintptr_t first = ((uintptr_t)segment + PAGE_BYTES - 1) &
+                          ~(uintptr_t)(PAGE_BYTES - 1);
+        uintptr_t end = (uintptr_t)(block + ((size_t)1 << class)) &
+                        ~(uintptr_t)(PAGE_BYTES - 1);
+        madvise((void *)first, end - first, MADV_DONTNEED);
+    }
+    block[0] = free_offsets[class];
+    free_offsets[class] = block - segment_arena;
+    stats.returned++;
+    return;
+#endif
+    if (class > MAX_CLASS) {
+        stats.large_freed++;
+        if (huge_pages) {
+            huge_pages_unmap(block, large_bytes(segment_length(segment)));
+        } else {
+            munmap(block, large_bytes(segment_length(segment)));
+        }
+        return;
+    }
+
+    Free_segment *node = (Free_segment *)block;
+    node->next = free_lists[class];
+    free_lists[class] = node;
+    stats.returned++;
+}
+
+/*
+ * segment_pool_report
+ * Description:
+ * - Prints how segments were allocated so far
+ * Parameters:
+ * - Where to print (FILE *out)
+ * Returns:
+ * - None
+ */
+void segment_pool_report(FILE *out)
+{
+    uint64_t small = stats.hits + stats.misses;
+
+    fprintf(out, "segment allocations: %llu\n",
+            (unsigned long long)(small + stats.large));
+#ifdef ARENA_SEGMENTS
+    fprintf(out, "  recycled %llu (%.1f%% hit rate), carved off the arena "
+            "%llu (%llu words)\n", (unsigned long long)stats.hits,
+            small ? 100.0 * stats.hits / small : 0.0,
+            (unsigned long long)stats.misses,
+            (unsigned long long)(arena_used - ARENA_START));
+#else
+    fprintf(out, "  small: %llu, recycled %llu (%.1f%% hit rate), "
+            "malloc'd %llu\n", (unsigned long long)small,
+            (unsigned long long)stats.hits,
+            small ? 100.0 * stats.hits / small : 0.0,
+            (unsigned long long)stats.misses);
+    fprintf(out, "  large (> %u words): %llu\n", (1u << MAX_CLASS) - 1,
+            (unsigned long long)stats.large);
+#endif
+    fprintf(out, "segment releases: %llu to free lists, %llu unmapped\n",
+            (unsigned long long)stats.returned,
+            (unsigned long long)stats.large_freed);
+}
+
+/*
+ * segment_pool_free
+ * Description:
+ * - Gives every segment on the free lists back to the system
+ * Parameters:
+ * - None
+ * Returns:
+ * - None
+ */
+void segment_pool_free()
+{
+#ifdef ARENA_SEGMENTS
+    if (segment_arena != NULL) {
+        munmap(segment_arena, ARENA_BYTES);
+        munmap(arena_mapped, MAPPED_BYTES);
+        segment_arena = NULL;
+        arena_mapped = NULL;
+        memset(free_offsets, 0, sizeof(free_offsets));
+        arena_used = ARENA_START;
+    }
+    return;
+#endif
+    for (int class = MIN_CLASS; class <= MAX_CLASS; class++) {
+        while (free_lists[class] != NULL) {
+            Free_segment *next = free_lists[class]->next;
+            free(free_lists[class]);
+            free_lists[class] = next;
+        }
+    }
+}
+
+/************************** Helper Functions *********************************/
+
+/*
+ * size_class
+ * Description:
+ * - Finds the power of two a block is rounded up to
+ * Parameters:
+ * - Number of words in the block, header included (size_t words)
+ * Returns:
+ * - log2 of the rounded size, at least MIN_CLASS; more than MAX_CLASS means
+ *   a large segment
+ */
+int size_class(size_t words)
+{
+    if (words <= (1u << MIN_CLASS)) {
+        return MIN_CLASS;
+    }
+    return 64 - __builtin_clzll(words - 1);
+}
+
+/*
+ * take
+ * Description:
+ * - Allocates a segment and its header without initializing its words
+ * Parameters:
+ * - Number of words in the segment (uint32_t words)
+ * Returns:
+ * - The segment (uint32_t *), with its length in the header
+ */
+uint32_t *take(uint32_t words)
+{
+    int class = size_class((size_t)words + HEADER_WORDS);
+    uint32_t *block;
+
+#ifdef ARENA_SEGMENTS
+    block = arena_take(class);
+    block[0] = words;
+    return block + HEADER_WORDS;
+#endif
+    if (class > MAX_CLASS) {
+        stats.large++;
+        if (huge_pages) {
+            block = huge_pages_map(large_bytes(words));
+        } else {
+            block = mmap(NULL, large_bytes(words), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (block == MAP_FAILED) {
+                block = NULL;
+            }
+        }
+    } else if (free_lists[class] != NULL) {
+        stats.hits++;
+        block = (uint32_t *)free_lists[class];
+        free_lists[class] = free_lists[class]->next;
+    } else {
+        stats.misses++;
+        block = malloc(sizeof(uint32_t) << class);
+    }
+
+    assert(block != NULL);
+    block[0] = words;
+    return block + 1;
+}
+
+/*
+ * large_bytes
+ * Description:
+ * - Finds the size of the mapping behind a large segment
+ * Parameters:
+ * - Number of words in the segment (uint32_t words)
+ * Returns:
+ * - Bytes for the header and the words (size_t)
+ */
+size_t large_bytes(uint32_t words)
+{
+    return ((size_t)words + HEADER_WORDS) * sizeof(uint32_t);
+}
+
+#ifdef ARENA_SEGMENTS
+/*
+ * arena_take
+ * Description:
+ * - Allocates a block of the arena, from the free list of its class or
+ *   else off the end of what has been carved so far
+ * Parameters:
+ * - Its size class (int class)
+ * Effects:
+ * - Reserves the arena on first use; exits once it is used up
+ * Returns:
+ * - The block (uint32_t *), header included
+ */
+uint32_t *arena_take(int class)
+{
+    if (segment_arena == NULL) {
+        arena_reserve();
+    }
+
+    uint32_t *block;
+    if (free_offsets[class] != 0) {
+        stats.hits++;
+        block = segment_arena + free_offsets[class];
+        free_offsets[class] = block[0];
+        return block;
+    }
+
+    stats.misses++;
+    if (arena_used + ((uint64_t)1 << class) > ARENA_WORDS) {
+        fprintf(stderr, "Segment arena exhausted\n");
+        exit(EXIT_FAILURE);
+    }
+    block = segment_arena + arena_used;
+    arena_used += (uint64_t)1 << class;
+    return block;
+}
+
+/*
+ * arena_reserve
+ * Description:
+ * - Reserves the address space of the arena and of its map of mapped
+ *   segments; pages are only backed by memory once written
+ * Parameters:
+ * - None
+ * Effects:
+ * - Exits if the address space can't be reserved
+ * Returns:
+ * - None
+ */
+void arena_reserve()
+{
+    void *start = mmap(NULL, ARENA_BYTES, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void *mapped = mmap(NULL, MAPPED_BYTES, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED || mapped == MAP_FAILED) {
+        fprintf(stderr, "Cannot reserve the segment arena\n");
+        exit(EXIT_FAILURE);
+    }
+    segment_arena = start;
+    arena_mapped = mapped;
+    if (huge_pages) {
+        madvise(start, ARENA_BYTES, MADV_HUGEPAGE);
+    }
+}
+
+/*
+ * clear_ends
+ * Description:
+ * - Zeroes the words of a range that share a page with words outside it;
+ *   the pages wholly inside it must read as 0 already
+ * Parameters:
+ * - The range (uint32_t *start, uint32_t *end)
+ * Returns:
+ * - None
+ */
+void clear_ends(uint32_t *start, uint32_t *end)
+{
+    uint32_t *first = (uint32_t *)(((uintptr_t)start + PAGE_BYTES - 1) &
+                                   ~(uintptr_t)(PAGE_BYTES - 1));
+    uint32_t *last = (uint32_t *)((uintptr_t)end &
+                                  ~(uintptr_t)(PAGE_BYTES - 1));
+    if (first >= last) {
+        memset(start, 0, (end - start) * sizeof(uint32_t));
+        return;
+    }
+    memset(start, 0, (first - start) * sizeof(uint32_t));
+    memset(last, 0, (end - last) * sizeof(uint32_t));
+}
+#endif
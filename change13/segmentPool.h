@@ -0,0 +1,54 @@
+/* segmentPool.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Interface of the allocator behind every segment of the UM.
+ */
+
+#ifndef SEGMENTPOOL_H_INCLUDED
+#define SEGMENTPOOL_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Number of words in a segment from the pool, read from its header */
+static inline uint32_t segment_length(const uint32_t *segment)
+{
+    return segment[-1];
+}
+
+#ifdef ARENA_SEGMENTS
+/* Start of the arena every segment is in (make SEGMENTS=arena) */
+extern uint32_t *segment_arena;
+
+/* One byte per word of the arena, 1 where a mapped segment starts */
+extern uint8_t *arena_mapped;
+
+/* Maps a segment from the pool: gives it the ID it is found by */
+static inline uint32_t arena_map(uint32_t *segment)
+{
+    uint32_t id = segment - segment_arena;
+    arena_mapped[id] = 1;
+    return id;
+}
+
+/* Unmaps a segment; its ID no longer finds it */
+static inline void arena_unmap(uint32_t *segment)
+{
+    uint32_t id = segment - segment_arena;
+    arena_mapped[id] = 0;
+}
+
+/* Tells whether an ID is that of a mapped segment */
+static inline int arena_is_mapped(uint32_t id)
+{
+    return arena_mapped[id];
+}
+#endif
+
+uint32_t *segment_pool_get(uint32_t words);
+uint32_t *segment_pool_copy(const uint32_t *segment);
+void segment_pool_put(uint32_t *segment);
+void segment_pool_report(FILE *out);
+void segment_pool_free();
+
+#endif
@@ -0,0 +1,194 @@
+/* trapChecks.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Fault handling behind make CHECKS=trap.
+ *
+ * In the trapping build, segmented load, segmented store and load program
+ * don't compare a segment ID against the table's length or test its slot
+ * before using it, and divide doesn't compare its divisor against 0.
+ * Instead:
+ *  - the segment table, reserved for all 2^32 IDs up front, is registered 
+ *    here (trap_reserve); only the part in use is readable, so the slot of
+ *    an ID past it can't be read
+ *  - the slot of an unmapped ID, and of an ID past the table's length that
+ *    has been committed, points into a PROT_NONE guard region (see
+ *    unmapped_slot), far enough from its end that reading the length
+ *    before it, or any word up to 2^32 after it, faults
+ *  - dividing by 0 raises SIGFPE on its own
+ * The handler turns a fault in a reserved region, or an integer divide by
+ * zero, into the same message and exit status as the checks would have
+ * given, and leaves any other fault to the default action. The offset
+ * check of a segmented load or store is still a comparison: a segment's
+ * words past its end belong to whatever comes next.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "assert.h"
+#include "trapChecks.h"
+
+/* Regions the handler treats as the UM's: the guard and segment tables */
+#define MAX_RESERVED 8
+
+char *trap_guard;
+volatile sig_atomic_t trap_storing;
+
+static struct {
+    char *start;
+    size_t bytes;
+} reserved[MAX_RESERVED];
+
+/********************* Private Function Declarations *************************/
+static void on_fault(int signal, siginfo_t *info, void *context);
+static int is_reserved(void *address);
+
+/************************** Function Definitions *****************************/
+
+/*
+ * trap_checks_init
+ * Description:
+ * - Reserves the guard region and installs the fault handlers; called
+ *   before the first segment table is made, and only once
+ * Parameters:
+ * - None
+ * Effects:
+ * - Exits if the address space can't be reserved
+ * Returns:
+ * - None
+ */
+void trap_checks_init()
+{
+    if (trap_guard != NULL) {
+        return;
+    }
+
+    /* A page before trap_guard too, for the length word of slot 0 */
+    size_t page = sysconf(_SC_PAGESIZE);
+    trap_guard = (char *)trap_reserve(page + TRAP_GUARD_BYTES) + page;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+    sigaction(SIGBUS, &action, NULL);
+    sigaction(SIGFPE, &action, NULL);
+}
+
+/*
+ * trap_reserve
+ * Description:
+ * - Reserves address space that can't be read or written until made so
+ *   with mprotect
+ * Parameters:
+ * - Its size in bytes (size_t bytes)
+ * Effects:
+ * - A fault in it is reported as a UM failure; exits if the address space
+ *   can't be reserved
+ * Returns:
+ * - The start of the region (void *), page aligned
+ */
+void *trap_reserve(size_t bytes)
+{
+    char *start = mmap(NULL, bytes, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) {
+        fprintf(stderr, "Cannot reserve %zu bytes of address space\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < MAX_RESERVED; i++) {
+        if (reserved[i].start == NULL) {
+            reserved[i].start = start;
+            reserved[i].bytes = bytes;
+            return start;
+        }
+    }
+    assert(0); /* more regions than MAX_RESERVED */
+    return NULL;
+}
+
+/*
+ * trap_release
+ * Description:
+ * - Gives a reserved region back
+ * Parameters:
+ * - The region, as given to trap_reserve (void *start, size_t bytes)
+ * Returns:
+ * - None
+ */
+void trap_release(void *start, size_t bytes)
+{
+    for (int i = 0; i < MAX_RESERVED; i++) {
+        if (reserved[i].start == start) {
+            reserved[i].start = NULL;
+        }
+    }
+    munmap(start, bytes);
+}
+
+/************************** Helper Functions *********************************/
+
+/*
+ * on_fault
+ * Description:
+ * - SIGSEGV, SIGBUS and SIGFPE handler: reports the failure the check
+ *   that faulted stands for. The fault comes from the cycle itself, never
+ *   from inside stdio, so printing and exiting (which flushes the UM's
+ *   output) is safe here
+ * Parameters:
+ * - The signal, what raised it and the context it interrupted
+ *   (int signal, siginfo_t *info, void *context)
+ * Effects:
+ * - Exits, unless the fault is not the UM's: then the default action is
+ *   restored and the faulting instruction runs again to take it
+ * Returns:
+ * - None
+ */
+void on_fault(int signal, siginfo_t *info, void *context)
+{
+    (void) context;
+    if (signal == SIGFPE && info->si_code == FPE_INTDIV) {
+        fprintf(stderr, "Cannot divide by zero.\n");
+        exit(EXIT_FAILURE); /* Failure mode */
+    }
+    if (signal != SIGFPE && is_reserved(info->si_addr)) {
+        if (trap_storing) {
+            fprintf(stderr, "Trying to store in unmapped segment\n");
+        } else {
+            fprintf(stderr, "Trying to load unmapped segment\n");
+        }
+        exit(EXIT_FAILURE); /* Failure mode */
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigemptyset(&action.sa_mask);
+    sigaction(signal, &action, NULL);
+}
+
+/*
+ * is_reserved
+ * Description:
+ * - Tells whether an address is in a region from trap_reserve
+ * Parameters:
+ * - The address (void *address)
+ * Returns:
+ * - 1 if it is, 0 if not
+ */
+int is_reserved(void *address)
+{
+    char *byte = address;
+    for (int i = 0; i < MAX_RESERVED; i++) {
+        if (reserved[i].start != NULL && byte >= reserved[i].start &&
+            byte < reserved[i].start + reserved[i].bytes) {
+            return 1;
+        }
+    }
+    return 0;
+}
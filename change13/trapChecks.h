@@ -0,0 +1,32 @@
+/* trapChecks.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Interface of the fault handling behind make CHECKS=trap.
+ */
+
+#ifndef TRAPCHECKS_H_INCLUDED
+#define TRAPCHECKS_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+
+/* Bytes of the guard region, past trap_guard, that unmapped slots point
+   into: a link of up to 2 * 2^32 plus an offset of up to 4 * 2^32 */
+#define TRAP_GUARD_BYTES (6ull << 32)
+
+/* Start of the guard region; see trap_checks_init */
+extern char *trap_guard;
+
+/* 1 while a segmented store looks up its segment, so a fault there is
+   reported as a store; set and cleared between TRAP_FENCEs */
+extern volatile sig_atomic_t trap_storing;
+
+/* Keeps the compiler from moving memory accesses across it */
+#define TRAP_FENCE() __asm__ __volatile__("" ::: "memory")
+
+void trap_checks_init();
+void *trap_reserve(size_t bytes);
+void trap_release(void *start, size_t bytes);
+
+#endif
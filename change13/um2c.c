@@ -0,0 +1,408 @@
+/* um2c.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Ahead-of-time translator from a UM program to C.
+ *
+ * Usage: um2c program.um > program.c
+ *        gcc -O2 program.c -o program
+ *
+ * Segment 0 is read with load_mem, so words are decoded exactly as the UM
+ * decodes them. Every word of segment 0 becomes a labeled C statement that
+ * works on the registers r0-r7 held in locals, and load program from
+ * segment 0 becomes a switch over those labels. The generated program
+ * carries a small interpreter with it: the rest of the run is interpreted
+ * once the program loads a program from another segment, or reaches a
+ * word of segment 0 it has overwritten with a different instruction.
+ */
+
+#include <string.h>
+#include "umInstructions.h"
+#include "segmentPool.h"
+
+/* Words of segment 0 translated into each C function. One huge function
+   takes gcc minutes to optimize; chunks keep it to seconds. */
+#define CHUNK_WORDS 256
+
+typedef enum Um_opcode {
+        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
+} Um_opcode;
+
+/* Runtime the generated program starts with: UM memory, the instructions
+   that need more than one line of C, and the fallback interpreter.
+   Diagnostics match the UM's. */
+static const char *runtime[] = {
+"#include <stdio.h>",
+"#include <stdlib.h>",
+"#include <stdint.h>",
+"#include <string.h>",
+"",
+"static uint32_t **seg;      /* segment i, NULL if unmapped */",
+"static uint32_t *seglen;    /* number of words in segment i */",
+"static uint32_t nseg, capseg;",
+"static uint32_t *freeids;   /* unmapped IDs, reused last in first out */",
+"static uint32_t nfree, capfree;",
+"",
+"static void __attribute__((noreturn)) fail(const char *message)",
+"{",
+"    fputs(message, stderr);",
+"    exit(EXIT_FAILURE);",
+"}",
+"",
+"static void *grow(void *array, uint32_t *cap, size_t size)",
+"{",
+"    *cap = *cap ? 2 * *cap : 64;",
+"    array = realloc(array, (size_t)*cap * size);",
+"    if (array == NULL) {",
+"        fail(\"Not enough memory!\");",
+"    }",
+"    return array;",
+"}",
+"",
+"static uint32_t map(uint32_t words)",
+"{",
+"    uint32_t *segment = calloc(words ? words : 1, sizeof(uint32_t));",
+"    uint32_t id;",
+"    if (segment == NULL) {",
+"        fail(\"Not enough memory!\");",
+"    }",
+"    if (nfree != 0) {",
+"        id = freeids[--nfree];",
+"    } else {",
+"        if (nseg == capseg) {",
+"            uint32_t cap = capseg;",
+"            seg = grow(seg, &cap, sizeof(*seg));",
+"            seglen = grow(seglen, &capseg, sizeof(*seglen));",
+"        }",
+"        id = nseg++;",
+"    }",
+"    seg[id] = segment;",
+"    seglen[id] = words;",
+"    return id;",
+"}",
+"",
+"static void unmap(uint32_t id)",
+"{",
+"    if (id == 0 || id >= nseg || seg[id] == NULL) {",
+"        fail(\"Can't unmap segment 0 or non-mapped segments\\n\");",
+"    }",
+"    free(seg[id]);",
+"    seg[id] = NULL;",
+"    seglen[id] = 0;",
+"    if (nfree == capfree) {",
+"        freeids = grow(freeids, &capfree, sizeof(*freeids));",
+"    }",
+"    freeids[nfree++] = id;",
+"}",
+"",
+"static inline uint32_t sload(uint32_t id, uint32_t offset)",
+"{",
+"    if (id >= nseg || seg[id] == NULL) {",
+"        fail(\"Trying to load unmapped segment\\n\");",
+"    }",
+"    if (offset >= seglen[id]) {",
+"        fail(\"Trying to access instruction out of bounds of mapped \"",
+"             \"segment\\n\");",
+"    }",
+"    return seg[id][offset];",
+"}",
+"",
+"static inline void sstore(uint32_t id, uint32_t offset, uint32_t value)",
+"{",
+"    if (id >= nseg || seg[id] == NULL) {",
+"        fail(\"Trying to store in unmapped segment\\n\");",
+"    }",
+"    if (offset >= seglen[id]) {",
+"        fail(\"Trying to access instruction out of bounds of mapped \"",
+"             \"segment\\n\");",
+"    }",
+"    seg[id][offset] = value;",
+"}",
+"",
+"static inline uint32_t divide(uint32_t b, uint32_t c)",
+"{",
+"    if (c == 0) {",
+"        fail(\"Cannot divide by zero.\\n\");",
+"    }",
+"    return b / c;",
+"}",
+"",
+"static inline void out(uint32_t c)",
+"{",
+"    if (c > 255) {",
+"        fail(\"Register c not within bounds\\n\");",
+"    }",
+"    putc(c, stdout);",
+"}",
+"",
+"static inline uint32_t in(void)",
+"{",
+"    int c = fgetc(stdin);",
+"    return c == EOF ? ~0u : (uint32_t)c;",
+"}",
+"",
+"/* Replaces segment 0 with a copy of segment id */",
+"static void load_segment(uint32_t id)",
+"{",
+"    if (id >= nseg || seg[id] == NULL) {",
+"        fail(\"Trying to load unmapped segment\\n\");",
+"    }",
+"    if (id != 0) {",
+"        free(seg[0]);",
+"        seg[0] = malloc((seglen[id] ? seglen[id] : 1) * sizeof(uint32_t));",
+"        if (seg[0] == NULL) {",
+"            fail(\"Not enough memory!\");",
+"        }",
+"        memcpy(seg[0], seg[id], seglen[id] * sizeof(uint32_t));",
+"        seglen[0] = seglen[id];",
+"    }",
+"}",
+"",
+"/* Runs segment 0 from pc until halt; never returns */",
+"static void __attribute__((noreturn, noinline))",
+"fallback(uint32_t pc, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3,",
+"         uint32_t r4, uint32_t r5, uint32_t r6, uint32_t r7)",
+"{",
+"    uint32_t r[8] = { r0, r1, r2, r3, r4, r5, r6, r7 };",
+"    for (;;) {",
+"        if (pc >= seglen[0]) {",
+"            fail(\"Invalid opcode\\n\");",
+"        }",
+"        uint32_t word = seg[0][pc++];",
+"        uint32_t a = (word >> 6) & 7, b = (word >> 3) & 7, c = word & 7;",
+"        switch (word >> 28) {",
+"            case 0: if (r[c] != 0) r[a] = r[b]; break;",
+"            case 1: r[a] = sload(r[b], r[c]); break;",
+"            case 2: sstore(r[a], r[b], r[c]); break;",
+"            case 3: r[a] = r[b] + r[c]; break;",
+"            case 4: r[a] = r[b] * r[c]; break;",
+"            case 5: r[a] = divide(r[b], r[c]); break;",
+"            case 6: r[a] = ~(r[b] & r[c]); break;",
+"            case 7: exit(EXIT_SUCCESS);",
+"            case 8: r[b] = map(r[c]); break;",
+"            case 9: unmap(r[c]); break;",
+"            case 10: out(r[c]); break;",
+"            case 11: r[c] = in(); break;",
+"            case 12: load_segment(r[b]); pc = r[c]; break;",
+"            case 13: r[(word >> 25) & 7] = word & 0x1ffffff; break;",
+"            default: fail(\"Invalid opcode\\n\");",
+"        }",
+"    }",
+"}",
+"",
+NULL
+};
+
+/********************* Private Function Declarations *************************/
+static void emit_program(FILE *out, Um_instruction *words, uint32_t length);
+static void emit_chunk(FILE *out, Um_instruction *words, uint32_t length,
+                       uint32_t k);
+static void emit_instruction(FILE *out, Um_instruction word, uint32_t i);
+
+/************************** Function Definitions *****************************/
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: um2c program.um > program.c\n");
+        exit(EXIT_FAILURE);
+    }
+
+    UM um = initialize_UM();
+    load_mem(argv[1], um);
+
+    emit_program(stdout, um->segmented_memory->array[0],
+                 segment_length(um->segmented_memory->array[0]));
+
+    free_UM(um);
+    segment_pool_free();
+    return 0;
+}
+
+/*
+ * emit_program
+ * Description:
+ * - Writes a complete C program equivalent to running segment 0 on the UM
+ * Parameters:
+ * - Where to write the C source (FILE *out)
+ * - The words of segment 0 (Um_instruction *words)
+ * - The number of words in segment 0 (uint32_t length)
+ * Returns:
+ * - None
+ */
+void emit_program(FILE *out, Um_instruction *words, uint32_t length)
+{
+    uint32_t chunks = (length + CHUNK_WORDS - 1) / CHUNK_WORDS;
+
+    for (int i = 0; runtime[i] != NULL; i++) {
+        fprintf(out, "%s\n", runtime[i]);
+    }
+
+    fprintf(out, "static const uint32_t program[%u] = {",
+            length ? length : 1);
+    for (uint32_t i = 0; i < length; i++) {
+        fprintf(out, "%s0x%08x,", i % 6 == 0 ? "\n    " : " ", words[i]);
+    }
+    fprintf(out, "%s\n};\n\n", length ? "" : "0");
+
+    /* A word is dirty while segment 0 holds something other than what
+       was translated for it */
+    fprintf(out,
+        "static uint8_t dirty[%u];\n\n"
+        "static inline void store_zero(uint32_t offset, uint32_t value)\n"
+        "{\n"
+        "    sstore(0, offset, value);\n"
+        "    if (offset < %u) {\n"
+        "        dirty[offset] = value != program[offset];\n"
+        "    }\n"
+        "}\n\n", length ? length : 1, length);
+
+    /* Leaving the translated code for the interpreter */
+    fprintf(out,
+        "#define FALLBACK(pc) fallback(pc, r0, r1, r2, r3, r4, r5, r6, r7)\n"
+        "#define GUARD(pc) if (dirty[pc]) { target = pc; goto stale; }\n"
+        "#define JUMP(pc) do { target = (pc); goto dispatch; } while (0)\n\n");
+
+    for (uint32_t k = 0; k < chunks; k++) {
+        emit_chunk(out, words, length, k);
+    }
+
+    fprintf(out,
+        "static uint32_t (*const chunks[%u])(uint32_t *, uint32_t) = {",
+        chunks ? chunks : 1);
+    for (uint32_t k = 0; k < chunks; k++) {
+        fprintf(out, "%schunk%u,", k % 6 == 0 ? "\n    " : " ", k);
+    }
+    fprintf(out, "%s\n};\n\n", chunks ? "" : "0");
+
+    fprintf(out,
+        "int main(void)\n"
+        "{\n"
+        "    uint32_t r[8] = { 0 }, pc = 0;\n\n"
+        "    map(%u);\n"
+        "    memcpy(seg[0], program, sizeof(uint32_t) * %u);\n"
+        "    for (;;) {\n"
+        "        if (pc >= %u) {\n"
+        "            fail(\"Invalid opcode\\n\");\n"
+        "        }\n"
+        "        pc = chunks[pc / %u](r, pc);\n"
+        "    }\n"
+        "}\n", length, length, length, CHUNK_WORDS);
+}
+
+/*
+ * emit_chunk
+ * Description:
+ * - Writes the function that runs one chunk of segment 0. The function
+ *   starts at pc and returns the pc it stopped at once control leaves the
+ *   chunk. Load program is a switch on the target, which gcc turns into a
+ *   jump table.
+ * Parameters:
+ * - Where to write the C source (FILE *out)
+ * - The words of segment 0 (Um_instruction *words)
+ * - The number of words in segment 0 (uint32_t length)
+ * - Which chunk to write (uint32_t k)
+ * Returns:
+ * - None
+ */
+void emit_chunk(FILE *out, Um_instruction *words, uint32_t length,
+                uint32_t k)
+{
+    uint32_t first = k * CHUNK_WORDS;
+    uint32_t last = first + CHUNK_WORDS < length ? first + CHUNK_WORDS
+                                                 : length;
+
+    fprintf(out,
+        "static uint32_t chunk%u(uint32_t *r, uint32_t target)\n"
+        "{\n"
+        "    uint32_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];\n"
+        "    uint32_t r4 = r[4], r5 = r[5], r6 = r[6], r7 = r[7];\n\n"
+        "    goto dispatch;\n", k);
+    for (uint32_t i = first; i < last; i++) {
+        emit_instruction(out, words[i], i);
+    }
+    fprintf(out,
+        "    target = %u;\n"
+        "leave:\n"
+        "    r[0] = r0; r[1] = r1; r[2] = r2; r[3] = r3;\n"
+        "    r[4] = r4; r[5] = r5; r[6] = r6; r[7] = r7;\n"
+        "    return target;\n"
+        "stale:\n"
+        "    FALLBACK(target);\n"
+        "dispatch:\n"
+        "    switch (target) {\n", last);
+    for (uint32_t i = first; i < last; i++) {
+        fprintf(out, "        case %u: goto L%u;\n", i, i);
+    }
+    fprintf(out, "        default: goto leave;\n"
+                 "    }\n"
+                 "}\n\n");
+}
+
+/*
+ * emit_instruction
+ * Description:
+ * - Writes the labeled C statement for one word of segment 0
+ * Parameters:
+ * - Where to write the C source (FILE *out)
+ * - The word (Um_instruction word)
+ * - Its index in segment 0 (uint32_t i)
+ * Returns:
+ * - None
+ */
+void emit_instruction(FILE *out, Um_instruction word, uint32_t i)
+{
+    Um_decoded inst = decode_instr(word);
+    unsigned a = inst.a, b = inst.b, c = inst.c;
+
+    fprintf(out, "L%u: GUARD(%u); ", i, i);
+    switch (inst.handler) {
+        case CMOV:
+            fprintf(out, "if (r%u != 0) r%u = r%u;\n", c, a, b);
+            break;
+        case SLOAD:
+            fprintf(out, "r%u = sload(r%u, r%u);\n", a, b, c);
+            break;
+        case SSTORE:
+            fprintf(out, "if (r%u == 0) store_zero(r%u, r%u); "
+                         "else sstore(r%u, r%u, r%u);\n", a, b, c, a, b, c);
+            break;
+        case ADD:
+            fprintf(out, "r%u = r%u + r%u;\n", a, b, c);
+            break;
+        case MUL:
+            fprintf(out, "r%u = r%u * r%u;\n", a, b, c);
+            break;
+        case DIV:
+            fprintf(out, "r%u = divide(r%u, r%u);\n", a, b, c);
+            break;
+        case NAND:
+            fprintf(out, "r%u = ~(r%u & r%u);\n", a, b, c);
+            break;
+        case HALT:
+            fprintf(out, "exit(EXIT_SUCCESS);\n");
+            break;
+        case ACTIVATE:
+            fprintf(out, "r%u = map(r%u);\n", b, c);
+            break;
+        case INACTIVATE:
+            fprintf(out, "unmap(r%u);\n", c);
+            break;
+        case OUT:
+            fprintf(out, "out(r%u);\n", c);
+            break;
+        case IN:
+            fprintf(out, "r%u = in();\n", c);
+            break;
+        case LOADP:
+            fprintf(out, "if (r%u != 0) { load_segment(r%u); "
+                         "FALLBACK(r%u); } JUMP(r%u);\n", b, b, c, c);
+            break;
+        case LV:
+            fprintf(out, "r%u = %uu;\n", a, inst.imm);
+            break;
+        default:
+            fprintf(out, "fail(\"Invalid opcode\\n\");\n");
+            break;
+    }
+}
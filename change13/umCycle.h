@@ -0,0 +1,516 @@
+/* umCycle.h
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * The execution cycle of the Universal Machine, written once and included 
+ * by umInstructions.c for every variant of the cycle it needs.
+ *
+ * Before each #include define:
+ *  - CYCLE_NAME: name of the (static) function to define
+ *  - CYCLE_SINGLE_STEP: 0 to run until halt, 1 to return after executing a
+ *    single instruction (used by the JIT to fall back to the interpreter)
+ *  - CYCLE_STATS: 1 to keep the counts of --stats in um->stats, 0 not to.
+ *    Instructions are not counted one by one: load program counts the 
+ *    jump into its target word, and stats_fold works out how often each 
+ *    word ran from those counts, at halt, before segment 0 is replaced and
+ *    around a word whose opcode a store changes
+ *  - CYCLE_PROFILE: 1 to call profile_sample with the next word to run 
+ *    after any instruction that profile_tick was set during, and tell the
+ *    profiler about every load program (--profile), 0 not to
+ * The function returns 1 once the halt instruction has run, 0 otherwise, and
+ * keeps um->program_counter up to date whenever it returns.
+ *
+ * Dispatch engine
+ * The cycle is compiled as one of two engines, chosen at build time (see 
+ * DISPATCH in the Makefile):
+ *  - switch (default): every instruction goes back through a single
+ *    switch statement at the top of the loop
+ *  - threaded (-DTHREADED_DISPATCH): every handler is a label and ends by
+ *    fetching the next instruction and jumping straight to its handler
+ *    through dispatch_table, so each opcode gets its own indirect branch
+ *    for the host branch predictor to learn
+ *  - specialized (-DSPECIALIZED_DISPATCH as well): the threaded engine,
+ *    plus a handler for every choice of registers of each instruction that
+ *    only works on registers, generated into umHandlers.h by genHandlers.
+ *    Jumps go through um->decoded_entries, the dispatch table entry of each
+ *    word of segment 0. Only the cycle that runs until halt without stats
+ *    (and without the profiler) is specialized; the others keep the 
+ *    threaded engine's handlers
+ * OP opens a handler, NEXT ends it.
+ *
+ * Checks
+ * With -DTRAP_CHECKS (make CHECKS=trap), segmented load, segmented store
+ * and load program don't check the segment ID and divide doesn't check 
+ * for 0: the fault a bad ID or divisor causes is reported instead, see
+ * trapChecks.c.
+ *
+ * Segments
+ * With -DARENA_SEGMENTS (make SEGMENTS=arena), a segment's ID is its
+ * offset in the arena every segment is allocated from, so finding it is an
+ * add, and it is mapped if its byte in arena_mapped is set (see
+ * segmentPool.c); the table only holds segment 0, and the unmapped IDs
+ * aren't linked.
+ */
+#if defined(SPECIALIZED_DISPATCH) && !CYCLE_SINGLE_STEP && !CYCLE_STATS && \
+    !CYCLE_PROFILE
+#define CYCLE_SPECIALIZED 1
+#else
+#define CYCLE_SPECIALIZED 0
+#endif
+
+#ifdef THREADED_DISPATCH
+#define OP(opcode) op_##opcode:
+#define NEXT                                                            \
+        do {                                                            \
+                if (CYCLE_SINGLE_STEP) {                                \
+                        um->program_counter = pc;                       \
+                        return 0;                                       \
+                }                                                       \
+                if (CYCLE_PROFILE && profile_tick) {                    \
+                        profile_sample(pc);                             \
+                }                                                       \
+                DISPATCH();                                             \
+        } while (0)
+#ifdef SPECIALIZED_DISPATCH
+#define DISPATCH()                                                      \
+        do {                                                            \
+                inst = program[pc++];                                   \
+                goto *dispatch_table[CYCLE_SPECIALIZED ?                \
+                                     entries[pc - 1] : inst.handler];   \
+        } while (0)
+#else
+#define DISPATCH()                                                      \
+        do {                                                            \
+                inst = program[pc++];                                   \
+                goto *dispatch_table[inst.handler];                     \
+        } while (0)
+#endif
+#else
+#define OP(opcode) case opcode:
+#define NEXT                                                            \
+        if (CYCLE_SINGLE_STEP) {                                        \
+                um->program_counter = pc;                               \
+                return 0;                                               \
+        }                                                               \
+        if (CYCLE_PROFILE && profile_tick) {                            \
+                profile_sample(pc);                                     \
+        }                                                               \
+        break
+#endif
+
+#ifdef THREADED_DISPATCH
+/* Labels as values are a GNU extension */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+static int CYCLE_NAME(UM um)
+{
+    char nothing;
+    uint32_t av, bv, cv, num_instructions;
+    Um_instruction *segment;
+    uint64_t twopow32 = 4294967296;
+    Um_instruction *r = um->registers;
+    Um_decoded *program = um->decoded_zero;
+    /* program[program_end] is the invalid opcode after segment 0; a pc 
+       past it is moved onto it */
+    uint32_t program_end = segment_length(vector_get(um->segmented_memory, 0));
+    uint32_t pc = min(um->program_counter, program_end);
+    Um_decoded inst;
+#ifdef SPECIALIZED_DISPATCH
+    uint16_t *entries = um->decoded_entries;
+#endif
+#ifdef THREADED_DISPATCH
+    static void *dispatch_table[] = {
+        &&op_CMOV, &&op_SLOAD, &&op_SSTORE, &&op_ADD, &&op_MUL, &&op_DIV,
+        &&op_NAND, &&op_HALT, &&op_ACTIVATE, &&op_INACTIVATE, &&op_OUT,
+        &&op_IN, &&op_LOADP, &&op_LV, &&op_INVALID, &&op_INVALID,
+#if CYCLE_SPECIALIZED
+#define UM_HANDLERS_LABELS
+#include "umHandlers.h"
+#undef UM_HANDLERS_LABELS
+        &&op_LV_SLOAD, &&op_LV_SSTORE, &&op_LV_LOADP, &&op_LV_LV,
+        &&op_IDIOM_SUB, &&op_IDIOM_AND, &&op_IDIOM_OR
+#endif
+    };
+
+    DISPATCH();
+    {
+#else
+    for (;;) {
+        inst = program[pc++];
+        
+        switch(inst.handler) {
+#endif
+            OP(CMOV)
+                (void) nothing;
+                if (r[inst.c] != 0) {
+                    r[inst.a] = r[inst.b];
+                }
+                NEXT;
+            OP(SLOAD) //segment load
+                /* Store value of registers b and c */
+                (void) nothing;
+
+                bv = r[inst.b];
+                cv = r[inst.c];
+                
+#ifdef TRAP_CHECKS
+                /* An ID past the table faults reading its slot, an 
+                   unmapped one reading the length (see trapChecks.c) */
+                segment = um->segmented_memory->array[bv];
+#else
+                if (!segment_is_mapped(um, bv)) {
+                    fprintf(stderr, "Trying to load unmapped segment\n");
+                    exit(EXIT_FAILURE); /* Failure mode */
+                }
+                segment = segment_get(um, bv);
+#endif
+                
+                /* The length sits in the word before the segment's data */
+                num_instructions = segment_length(segment);
+
+                if (cv >= num_instructions) {
+                    fprintf(stderr, "Trying to access instruction out of bounds ");
+                    fprintf(stderr, "of mapped segment\n");
+                    exit(EXIT_FAILURE); /* Failure mode */
+                }
+                
+                r[inst.a] = segment[cv];
+                NEXT;
+            OP(SSTORE) //segment store
+                (void) nothing;
+                /* Store value of registers a, b, and c */
+                av = r[inst.a];
+                bv = r[inst.b];
+                cv = r[inst.c];
+                
+#ifdef TRAP_CHECKS
+                trap_storing = 1;
+                TRAP_FENCE();
+                segment = um->segmented_memory->array[av];
+                num_instructions = segment_length(segment);
+                TRAP_FENCE();
+                trap_storing = 0;
+#else
+                if (!segment_is_mapped(um, av)) {
+                    fprintf(stderr, "Trying to store in unmapped segment\n");
+                    exit(EXIT_FAILURE); /* Failure mode */
+                }
+                
+                segment = segment_get(um, av);
+                num_instructions = segment_length(segment);
+#endif
+                
+                if (bv >= num_instructions) {
+                    fprintf(stderr, "Trying to access instruction out of bounds ");
+                    fprintf(stderr, "of mapped segment\n");
+                    exit(EXIT_FAILURE); /* Failure mode */
+                }
+
+                /* Copy on write: segment 0 and the segment it was loaded 
+                   from stop sharing words once either is written */
+                if (um->zero_shared_with != 0 &&
+                    (av == 0 || av == um->zero_shared_with)) {
+                    unshare_segment_zero(um);
+                    segment = segment_get(um, av);
+                }
+
+                segment[bv] = cv;
+
+                /* Self-modifying code: redecode the overwritten word */
+                if (av == 0) {
+                    if (CYCLE_STATS && bv < um->stats->length &&
+                        program[bv].handler != cv >> 28) {
+                        stats_word_changing(um, bv, pc);
+                    }
+                    program[bv] = decode_instr(cv);
+#ifdef SPECIALIZED_DISPATCH
+                    decode_entries(um, bv > ENTRY_REACH ? 
+                                   bv - ENTRY_REACH : 0, bv + 1);
+#endif
+                }
+                NEXT;
+            OP(ADD) //add
+                (void) nothing;
+                r[inst.a] = (r[inst.b] + r[inst.c]) % twopow32;
+                NEXT;
+            OP(MUL) //multiply
+                (void) nothing;
+                r[inst.a] = (r[inst.b] * r[inst.c]) % twopow32;
+                NEXT;
+            OP(DIV) //divide
+                (void) nothing;
+#ifndef TRAP_CHECKS
+                if (r[inst.c] == 0) {
+                    fprintf(stderr, "Cannot divide by zero.\n");
+                    exit(EXIT_FAILURE); /* Failure mode */
+                }
+#endif
+                r[inst.a] = (r[inst.b] / r[inst.c]);
+                NEXT;
+            OP(NAND) //nand
+                (void) nothing;
+                r[inst.a] = ~(r[inst.b] & r[inst.c]);
+                NEXT;
+            OP(HALT) //halt
+                (void) nothing;
+                /* --perf counts the UM's work, not freeing its memory */
+                perf_counters_stop();
+                uint64_t segmented_mem_len = vector_length(um->segmented_memory);
+                for (uint64_t i = 0; i < segmented_mem_len; i++) {
+                    value_type slot = vector_get(um->segmented_memory, i);
+                    if (is_mapped(slot) && (i != 0 || um->zero_shared_with == 0)) {
+                        segment_pool_put(slot);
+                    }
+                }
+                if (CYCLE_STATS) {
+                    stats_fold(um, 0, um->stats->length, UINT32_MAX);
+                }
+                vector_free(um->segmented_memory);
+                free_decoded(um);
+                output_buffer_flush();
+                um->program_counter = pc;
+                return 1;
+            OP(ACTIVATE) //activate, map
+                (void) nothing;
+                /* Declares and initializes a new segment on the heap */
+                uint32_t num_words = r[inst.c];
+
+                Um_instruction *new_segment = segment_pool_get(num_words);
+                if (CYCLE_STATS) {
+                    um->stats->maps++;
+                    stats_mapped(um->stats, 1, num_words);
+                }
+                
+#ifdef ARENA_SEGMENTS
+                /* The segment's ID is its offset in the arena */
+                r[inst.b] = arena_map(new_segment);
+#else
+                /* Check if any segments have been unmapped whose IDs can be reused */
+                if (um->unmapped_head != 0) {
+                    /* Maps segment with ID of the last segment unmapped */
+                    uint32_t reusableID = um->unmapped_head;
+                    um->unmapped_head = 
+                        next_unmapped(vector_get(um->segmented_memory, reusableID));
+                    vector_put(um->segmented_memory, reusableID, new_segment);
+                    r[inst.b] = reusableID;
+                } else {
+                    /* Maps segment with new ID */
+                    vector_addhi(um->segmented_memory, new_segment);
+                    r[inst.b] = vector_length(um->segmented_memory) - 1;
+                }
+#endif
+                NEXT;
+            OP(INACTIVATE) //inactivate, unmap
+                (void) nothing;
+                uint32_t unmappedID = r[inst.c];
+            
+                if (unmappedID == 0 || !segment_is_mapped(um, unmappedID)) {
+                    fprintf(stderr, "Can't unmap segment 0 or non-mapped segments\n");
+                    exit(EXIT_FAILURE); /* Failure mode */
+                }
+            
+                if (CYCLE_STATS) {
+                    um->stats->unmaps++;
+                    stats_mapped(um->stats, -1, -(int64_t)segment_length(
+                                 segment_get(um, unmappedID)));
+                }
+#ifdef ARENA_SEGMENTS
+                arena_unmap(segment_get(um, unmappedID));
+#endif
+
+                /* Unmaps the segment; words it shares now belong to 
+                   segment 0 alone */
+                if (unmappedID == um->zero_shared_with) {
+                    um->zero_shared_with = 0;
+                } else {
+                    segment_pool_put(segment_get(um, unmappedID));
+                }
+            
+#ifndef ARENA_SEGMENTS
+                /* The slot now links the unmapped IDs, last unmapped first */
+                vector_put(um->segmented_memory, unmappedID, 
+                           unmapped_slot(um->unmapped_head));
+                um->unmapped_head = unmappedID;
+#endif
+                NEXT;
+            OP(OUT) //output
+                (void) nothing;
+                uint32_t c = r[inst.c];
+                if (c > 255) {
+                /* Failure mode: unchecked runtime error */
+                    fprintf(stderr, "Register c not within bounds\n");
+                    exit(EXIT_FAILURE);
+                    }
+                output_buffer_put(c);
+                NEXT;
+            OP(IN) //input
+                (void) nothing;
+                /* Snapshot the machine as it is just before this input */
+                if (um->snapshot_at_input != NULL) {
+                    save_snapshot(um, pc - 1);
+                    um->snapshot_at_input = NULL;
+                }
+                int inputval = input_buffer_get();
+            
+                /* Contract Violation */
+                if (inputval < -1 || inputval > 255) { /* EOF == -1 */
+                    fprintf(stderr, "Contract Violation: Must input value between 0 and");
+                    fprintf(stderr, " 255\n");
+                    exit(EXIT_FAILURE);
+                }
+            
+                if (inputval != EOF) {
+                    r[inst.c] = inputval;
+                } else {
+                    r[inst.c] = ~0;
+                }
+                NEXT;
+            OP(LOADP) //load program
+                (void) nothing;
+                bv = r[inst.b];
+            
+#ifdef TRAP_CHECKS
+                /* Segment 0 is always mapped; any other ID is checked by
+                   reading its length, which faults if it is unmapped */
+                if (bv != 0) {
+                    (void) *(volatile uint32_t *)
+                        (um->segmented_memory->array[bv] - 1);
+                }
+#else
+                if (!segment_is_mapped(um, bv)) {
+                        fprintf(stderr, "Trying to load unmapped segment\n");
+                        exit(EXIT_FAILURE); /* Failure mode */
+                    }
+#endif
+            
+                if (CYCLE_STATS && bv == 0) {
+                    um->stats->loadp_jumps++;
+                } else if (CYCLE_STATS) {
+                    um->stats->loadp_copies++;
+                    segment = segment_get(um, bv);
+                    stats_mapped(um->stats, 0, (int64_t)segment_length(segment)
+                                 - um->stats->length);
+                }
+
+                /* Segment 0 shares the words of $m[r[B]] instead of copying
+                   them; loading the segment it already shares costs 
+                   nothing */
+                if (bv != 0 && bv != um->zero_shared_with) {
+                    if (CYCLE_STATS) {
+                        stats_fold(um, 0, um->stats->length, UINT32_MAX);
+                    }
+                    if (um->zero_shared_with == 0) {
+                        segment_pool_put(vector_get(um->segmented_memory, 0));
+                    }
+                    vector_put(um->segmented_memory, 0, segment_get(um, bv));
+                    um->zero_shared_with = bv;
+                    if (CYCLE_PROFILE) {
+                        profile_new_program();
+                    }
+
+                    decode_segment_zero(um);
+                    program = um->decoded_zero;
+                    program_end = segment_length(segment_get(um, bv));
+#ifdef SPECIALIZED_DISPATCH
+                    entries = um->decoded_entries;
+#endif
+                    if (CYCLE_STATS) {
+                        stats_segment_zero(um);
+                    }
+                }
+            
+                if (CYCLE_STATS && pc - 1 > um->stats->reached) {
+                    um->stats->reached = pc - 1;
+                }
+                pc = min(r[inst.c], program_end);
+                if (CYCLE_STATS && pc < um->stats->length) {
+                    um->stats->entries[pc]++;
+                    um->stats->run_start = pc;
+                }
+                if (CYCLE_PROFILE) {
+                    profile_entered(pc);
+                }
+                NEXT;
+            OP(LV) //load value
+                (void) nothing;
+                r[inst.a] = inst.imm;
+                NEXT;
+#if CYCLE_SPECIALIZED
+#include "umHandlers.h"
+            /* A load value fused with the instruction after it (in the
+               order of Um_fused): that instruction's generic handler runs
+               without a dispatch in between */
+            op_LV_SLOAD:
+                r[inst.a] = inst.imm;
+                inst = program[pc++];
+                goto op_SLOAD;
+            op_LV_SSTORE:
+                r[inst.a] = inst.imm;
+                inst = program[pc++];
+                goto op_SSTORE;
+            op_LV_LOADP:
+                r[inst.a] = inst.imm;
+                inst = program[pc++];
+                goto op_LOADP;
+            op_LV_LV:
+                r[inst.a] = inst.imm;
+                inst = program[pc++];
+                goto op_LV;
+            /* Idioms built from nand (see idiom_entry): every operand is
+               read before any register is written */
+            op_IDIOM_SUB:
+                /* nand t, y, y; add d, x, t; lv t, 1; add d, t, d */
+                cv = inst.a;
+                bv = r[inst.b];
+                inst = program[pc];
+                av = r[inst.b + inst.c - cv]; /* the operand that isn't t */
+                r[cv] = 1;
+                r[inst.a] = av - bv;
+                pc += 3;
+                NEXT;
+            op_IDIOM_AND:
+                /* nand t, a, b; nand t, t, t */
+                r[inst.a] = r[inst.b] & r[inst.c];
+                pc += 1;
+                NEXT;
+            op_IDIOM_OR:
+                /* nand p, a, a; nand q, b, b; nand d, p, q */
+                cv = inst.a;
+                av = r[inst.b];
+                inst = program[pc];
+                bv = r[inst.b];
+                r[cv] = ~av;
+                r[inst.a] = ~bv;
+                r[program[pc + 1].a] = av | bv;
+                pc += 2;
+                NEXT;
+            divide_by_zero:
+                fprintf(stderr, "Cannot divide by zero.\n");
+                exit(EXIT_FAILURE); /* Failure mode */
+#endif
+#ifdef THREADED_DISPATCH
+            op_INVALID:
+#else
+            default: 
+#endif
+                /* Failure mode: opcode out of range */
+                fprintf(stderr, "Invalid opcode\n");
+                exit(EXIT_FAILURE);
+                NEXT;
+        }
+#ifndef THREADED_DISPATCH
+    }
+#endif
+}
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+#undef OP
+#undef NEXT
+#undef DISPATCH
+#undef CYCLE_NAME
+#undef CYCLE_SINGLE_STEP
+#undef CYCLE_STATS
+#undef CYCLE_PROFILE
+#undef CYCLE_SPECIALIZED
@@ -5,47 +5,112 @@
  */
  
  #include "umInstructions.h"
+ #include "segmentPool.h"
+#include "outputBuffer.h"
+#include "inputBuffer.h"
+#include "profiler.h"
+#include "trapChecks.h"
+#include "hugePages.h"
+#include "perfCounters.h"
+
+#if defined(ARENA_SEGMENTS) && defined(TRAP_CHECKS)
+#error "SEGMENTS=arena checks segment IDs itself; it can't use CHECKS=trap"
+#endif
+ #include <string.h>
+ #include <errno.h>
  #include <time.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+ #include <sys/mman.h>
  
  #define INITIAL_CAPACITY 64
 
+/* The segment table is reserved for every possible ID */
+#define TABLE_SLOTS (1ull << 32)
+#define TABLE_BYTES (sizeof(value_type) * TABLE_SLOTS)
+
  #define min(x,y) (((x)<(y))?(x):(y))
+
+/* Opcode names for report_stats */
+static const char *opcode_names[16] = {
+        "cmov", "sload", "sstore", "add", "mul", "div", "nand", "halt",
+        "map", "unmap", "out", "in", "loadp", "lv", "invalid", "invalid"
+};
+
+/* Sequences report_stats lists of each length */
+#define TOP_SEQUENCES 10
+
+#ifdef SPECIALIZED_DISPATCH
+#define UM_HANDLERS_ENTRIES
+#include "umHandlers.h"
+#undef UM_HANDLERS_ENTRIES
+
+/* Dispatch table entries after the specialized handlers: a load value 
+   fused with the instruction after it, see decode_entries. These are the
+   pairs --stats finds most often in midmark, sandmark, advent and codex.
+   Then the idioms idiom_entry recognizes. */
+typedef enum Um_fused {
+        LV_SLOAD = SPECIALIZED_END, LV_SSTORE, LV_LOADP, LV_LV,
+        IDIOM_SUB, IDIOM_AND, IDIOM_OR
+} Um_fused;
+#endif
  
  typedef enum Um_opcode {
          CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
-         NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
+         NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV, INVALID
  } Um_opcode;
 
- /********************* uint32_vector interface ******************************/
-
-static inline uint32_vector uint32_vector_new();
-static inline void uint32_vector_free(uint32_vector v);
-static inline uint32_t uint32_vector_get(uint32_vector v, int i); //each value is a segment
-static inline void uint32_vector_put(uint32_vector v, int i, uint32_t value); //i == index
-static inline void uint32_vector_addhi(uint32_vector v, uint32_t value);
-static inline void uint32_vector_add_at(uint32_vector v, int i, uint32_t 
-                                         value);
-static inline uint32_t uint32_vector_remove_at(uint32_vector v, int i);
-static inline int uint32_vector_is_empty(uint32_vector v);
-static inline int uint32_vector_length(uint32_vector v);
-static inline void uint32_vector_clear(uint32_vector v);
- 
+#ifdef SPECIALIZED_DISPATCH
+/* Fused handler of a load value followed by each opcode, 0 for none */
+static const uint16_t lv_fused[16] = {
+        [SLOAD] = LV_SLOAD, [SSTORE] = LV_SSTORE, [LOADP] = LV_LOADP, 
+        [LV] = LV_LV
+};
+#endif
+
  /********************* vector interface *************************************/
 
 static inline vector vector_new();
 static inline void vector_free(vector v);
-static inline value_type vector_get(vector v, int i); //each value is a segment
-static inline void vector_put(vector v, int i, value_type value); //i == index
+static void vector_commit(vector v, uint64_t capacity);
+static inline value_type vector_get(vector v, uint32_t i); //each value is a segment
+static inline void vector_put(vector v, uint32_t i, value_type value); //i == index
 static inline void vector_addhi(vector v, value_type value);
-static inline void vector_add_at(vector v, int i, value_type value);
-static inline value_type vector_remove_at(vector v, int i);
+static inline void vector_add_at(vector v, uint32_t i, value_type value);
+static inline value_type vector_remove_at(vector v, uint32_t i);
 static inline int vector_is_empty(vector v);
-static inline int vector_length(vector v);
+static inline uint64_t vector_length(vector v);
 static inline void vector_clear(vector v);
 
 /* Helper Function */
 static inline uint32_t get_reg_i(Um_instruction instruction, char character);
 static inline uint64_t bp_get_u(uint64_t word, unsigned width, unsigned lsb);
+static void decode_segment_zero(UM um);
+#ifdef SPECIALIZED_DISPATCH
+static uint16_t idiom_entry(Um_decoded *words, uint32_t length);
+#endif
+static void unshare_segment_zero(UM um);
+static void free_decoded(UM um);
+static uint8_t *read_all(int fd, size_t *size);
+static void load_words(Um_instruction *words, const uint8_t *bytes, 
+                       uint32_t count);
+static inline int is_mapped(value_type slot);
+static inline value_type unmapped_slot(uint32_t next);
+static inline uint32_t next_unmapped(value_type slot);
+static int unmapped_ids_ok(UM um);
+static inline int segment_is_mapped(UM um, uint32_t id);
+static inline value_type segment_get(UM um, uint32_t id);
+static void stats_fold(UM um, uint32_t first, uint32_t end, 
+                       uint32_t resume);
+static void stats_word_changing(UM um, uint32_t word, uint32_t pc);
+static inline int falls_through(uint8_t handler);
+static void report_sequences(FILE *out, uint64_t *counts, int opcodes, 
+                             uint64_t total);
+static int compare_counts(const void *a, const void *b);
+static inline int stopped_between(Um_stats *stats, uint32_t from, 
+                                  uint32_t to, uint32_t resume);
+static void stats_segment_zero(UM um);
+static void stats_mapped(Um_stats *stats, int64_t segments, int64_t words);
 
 /************************** Function Definitions *****************************/
 
@@ -76,58 +141,277 @@ UM initialize_UM()
         um->registers[i] = 0;
     }
     
+#ifdef TRAP_CHECKS
+    trap_checks_init();
+#endif
     um->segmented_memory = vector_new();
-    um->segment_lengths = uint32_vector_new();
-    um->unmappedID = uint32_vector_new();
+    um->unmapped_head = 0;
     um->program_counter = 0;
+    um->decoded_zero = NULL;
+    um->decoded_capacity = 0;
+    um->decoded_entries = NULL;
+    um->zero_shared_with = 0;
+    um->snapshot_at_input = NULL;
+    um->stats = NULL;
+    um->profile = 0;
     
     return um;
 }
 
+/* 
+ * free_UM
+ * Description:
+ * - Releases a UM that was loaded but never run (running to halt releases
+ *   its segments and tables already)
+ * Parameters:
+ * - Pointer to a UM with a loaded segment 0 (UM um)
+ * Effects:
+ * - um can no longer be used
+ * Returns:
+ * - None
+ */
+void free_UM(UM um)
+{
+    segment_pool_put(vector_get(um->segmented_memory, 0));
+    vector_free(um->segmented_memory);
+    free_decoded(um);
+    free(um);
+}
+
 /* 
  * load_mem
  * Description:
  * - Loads the instructions given in the file and stores it in segment 0 of 
  *   the Universal Machine passed in
  * Parameters:
- * - The filename of the file containing UM instructions (char *filename)
+ * - The filename of the file containing UM instructions, or "-" for 
+ *   standard input (char *filename)
  * - Pointer to a Universal Machine struct (UM um)
  * Effects:
- * - $m[0] is loaded with the instructions given in the file
+ * - $m[0] is loaded with the instructions given in the file. A regular file
+ *   is mapped into memory; anything else (a pipe, standard input) is read 
+ *   until end of file. Bytes after the last whole word are ignored.
  * Returns:
  * - None
  */
 void load_mem(char *filename, UM um) 
 {
-    FILE *input = fopen(filename, "r");
-    assert(input != NULL);
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO 
+                                        : open(filename, O_RDONLY);
+    assert(fd >= 0);
     
     struct stat buf;
-    stat(filename, &buf);
+    int stat_result = fstat(fd, &buf);
+    assert(stat_result == 0);
+    (void) stat_result;
+    
+    uint8_t *bytes;
+    size_t filesize;
+    int mapped = S_ISREG(buf.st_mode) && buf.st_size > 0;
     
-    /* Filesize in bytes */
-    off_t filesize = buf.st_size;
-    int num_instructions = filesize >> 2;
+    if (mapped) {
+        filesize = buf.st_size;
+        bytes = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+        assert(bytes != MAP_FAILED);
+    } else {
+        bytes = read_all(fd, &filesize);
+    }
     
-    Um_instruction *segment_zero = malloc(num_instructions * 4);
-    assert(segment_zero != NULL);
+    /* Each word is stored big-endian */
+    uint32_t num_instructions = filesize >> 2;
+    Um_instruction *segment_zero = segment_pool_get(num_instructions);
+    load_words(segment_zero, bytes, num_instructions);
     
-    /* Packs each 4 characters in file into an instruction and stores that 
-       in segment zero */
-    for (int i = 0; i < num_instructions; i++) {
-        Um_instruction tempinstruction = 0;
-        for (int j = 0; j < 4; j++) {
-            tempinstruction = Bitpack_newu(tempinstruction, 8, (24 - (8 * j)),
-                                           fgetc(input));
-        }
-        segment_zero[i] = tempinstruction;
+    if (mapped) {
+        munmap(bytes, filesize);
+    } else {
+        free(bytes);
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
     }
     
     /* Updates the UM struct */
     vector_addhi(um->segmented_memory, segment_zero);
-    uint32_vector_addhi(um->segment_lengths, num_instructions);
+    decode_segment_zero(um);
+}
+
+/* Snapshot file layout, native byte order:
+ *   Um_snapshot_header
+ *   for every slot of um->segmented_memory: two words, the slot's kind and
+ *   either its length (a mapped segment, whose words follow) or the next
+ *   unmapped ID (an unmapped slot) */
+typedef struct Um_snapshot_header {
+    char magic[8];
+    uint32_t registers[8];
+    uint32_t program_counter;
+    uint32_t unmapped_head;
+    uint64_t num_slots;     /* the table can hold all 2^32 IDs */
+} Um_snapshot_header;
+
+static const char snapshot_magic[8] = "UMSNAP2";
+
+enum { SNAPSHOT_UNMAPPED = 0, SNAPSHOT_MAPPED = 1 };
+
+/* 
+ * save_snapshot
+ * Description:
+ * - Writes the whole machine to um->snapshot_at_input so load_snapshot can
+ *   resume it later
+ * Parameters:
+ * - Pointer to a running Universal Machine struct (UM um)
+ * - The program counter to resume at (uint32_t pc)
+ * Effects:
+ * - Creates or overwrites the snapshot file; exits if it can't be written
+ * Returns:
+ * - None
+ */
+void save_snapshot(UM um, uint32_t pc)
+{
+    FILE *output = fopen(um->snapshot_at_input, "wb");
+    if (output == NULL) {
+        fprintf(stderr, "Cannot write snapshot %s\n", um->snapshot_at_input);
+        exit(EXIT_FAILURE);
+    }
+    
+    Um_snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    memcpy(header.registers, um->registers, sizeof(header.registers));
+    header.program_counter = pc;
+    header.unmapped_head = um->unmapped_head;
+    header.num_slots = vector_length(um->segmented_memory);
+    int ok = fwrite(&header, sizeof(header), 1, output) == 1;
+    
+    /* A segment shared with segment 0 is simply written twice */
+    for (uint64_t i = 0; ok && i < header.num_slots; i++) {
+        value_type slot = vector_get(um->segmented_memory, i);
+        uint32_t entry[2];
+        if (is_mapped(slot)) {
+            entry[0] = SNAPSHOT_MAPPED;
+            entry[1] = segment_length(slot);
+        } else {
+            entry[0] = SNAPSHOT_UNMAPPED;
+            entry[1] = next_unmapped(slot);
+        }
+        ok = fwrite(entry, sizeof(entry), 1, output) == 1;
+        if (ok && entry[0] == SNAPSHOT_MAPPED) {
+            ok = fwrite(slot, sizeof(uint32_t), entry[1], output) == entry[1];
+        }
+    }
+    
+    if (fclose(output) != 0 || !ok) {
+        fprintf(stderr, "Cannot write snapshot %s\n", um->snapshot_at_input);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* 
+ * load_snapshot
+ * Description:
+ * - Restores a machine written by save_snapshot, instead of load_mem
+ * Parameters:
+ * - The filename of the snapshot (char *filename)
+ * - Pointer to a Universal Machine struct from initialize_UM (UM um)
+ * Effects:
+ * - Registers, program counter, segments and unmapped IDs are those of the
+ *   snapshot; exits if the file is not a snapshot
+ * Returns:
+ * - None
+ */
+void load_snapshot(char *filename, UM um)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat buf;
+    if (fd < 0 || fstat(fd, &buf) != 0) {
+        fprintf(stderr, "Cannot read snapshot %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    
+    size_t size = buf.st_size;
+    const uint8_t *image = size == 0 ? MAP_FAILED 
+                           : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    
+    Um_snapshot_header header;
+    if (image == MAP_FAILED || size < sizeof(header) ||
+        memcmp(image, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+        fprintf(stderr, "%s is not a UM snapshot\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(&header, image, sizeof(header));
+    memcpy(um->registers, header.registers, sizeof(header.registers));
+    um->program_counter = header.program_counter;
+    um->unmapped_head = header.unmapped_head;
+    
+    size_t offset = sizeof(header);
+    for (uint64_t i = 0; i < header.num_slots; i++) {
+        uint32_t entry[2];
+        if (size - offset < sizeof(entry)) {
+            break;
+        }
+        memcpy(entry, image + offset, sizeof(entry));
+        offset += sizeof(entry);
+        
+        if (entry[0] == SNAPSHOT_UNMAPPED) {
+            vector_addhi(um->segmented_memory, unmapped_slot(entry[1]));
+            continue;
+        }
+        if (entry[0] != SNAPSHOT_MAPPED) {
+            break;
+        }
+        size_t bytes = (size_t)entry[1] * sizeof(uint32_t);
+        if (size - offset < bytes) {
+            break;
+        }
+        Um_instruction *segment = segment_pool_get(entry[1]);
+        memcpy(segment, image + offset, bytes);
+        offset += bytes;
+        vector_addhi(um->segmented_memory, segment);
+    }
+    munmap((void *)image, size);
+    
+    if (vector_length(um->segmented_memory) != header.num_slots ||
+        header.num_slots == 0 || 
+        !is_mapped(vector_get(um->segmented_memory, 0))) {
+        fprintf(stderr, "Snapshot %s is truncated\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (!unmapped_ids_ok(um)) {
+        fprintf(stderr, "%s is not a UM snapshot\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    decode_segment_zero(um);
+}
 
-    fclose(input);
+/* 
+ * unmapped_ids_ok
+ * Description:
+ * - Checks the list of unmapped IDs a snapshot restored: from 
+ *   um->unmapped_head, every link must name an unmapped slot of the 
+ *   table, and the list must end (in 0) without coming back to an ID
+ * Parameters:
+ * - Pointer to a UM restored by load_snapshot (UM um)
+ * Returns:
+ * - 1 if map can safely take IDs from the list, 0 otherwise
+ */
+int unmapped_ids_ok(UM um)
+{
+    uint64_t slots = vector_length(um->segmented_memory);
+    uint64_t steps = 0;
+
+    /* A list longer than the table has visited some ID twice */
+    for (uint32_t id = um->unmapped_head; id != 0; steps++) {
+        if (id >= slots || steps == slots) {
+            return 0;
+        }
+        value_type slot = vector_get(um->segmented_memory, id);
+        if (is_mapped(slot)) {
+            return 0;
+        }
+        id = next_unmapped(slot);
+    }
+    return 1;
 }
 
 /************************** end of um.c *****************************/
@@ -135,6 +419,30 @@ void load_mem(char *filename, UM um)
 
 
 
+#define CYCLE_NAME run_cycle
+#define CYCLE_SINGLE_STEP 0
+#define CYCLE_STATS 0
+#define CYCLE_PROFILE 0
+#include "umCycle.h"
+
+#define CYCLE_NAME step_cycle
+#define CYCLE_SINGLE_STEP 1
+#define CYCLE_STATS 0
+#define CYCLE_PROFILE 0
+#include "umCycle.h"
+
+#define CYCLE_NAME stats_cycle
+#define CYCLE_SINGLE_STEP 0
+#define CYCLE_STATS 1
+#define CYCLE_PROFILE 0
+#include "umCycle.h"
+
+#define CYCLE_NAME profile_cycle
+#define CYCLE_SINGLE_STEP 0
+#define CYCLE_STATS 0
+#define CYCLE_PROFILE 1
+#include "umCycle.h"
+
 /* 
  * execute_instr
  * Description:
@@ -148,226 +456,132 @@ void load_mem(char *filename, UM um)
  */
 void execute_instr(UM um)
 {
-    register uint64_t op_code = 0;
-    char nothing;
-    uint32_t av, bv, cv, num_instructions;
-    uint64_t twopow32 = 4294967296;
-    while (op_code != 7) {
-        // fprintf(stderr, "in while\n");
-        Um_instruction *while_segment_zero = um->segmented_memory->array[0];
-        Um_instruction curr_instruction = while_segment_zero[um->program_counter]; 
-        //op_code = bp_get_u(curr_instruction, 4, 28);
-        op_code = (uint64_t)curr_instruction << 32;
-        op_code = op_code >> 60;
-        
-        switch(op_code) {
-            case 0: 
-                (void) nothing;
-                if (um->registers[get_reg_i(curr_instruction, 'c')] != 0) {
-                    um->registers[get_reg_i(curr_instruction, 'a')] = um->registers[get_reg_i(curr_instruction, 'b')];
-                }
-                break;
-            case 1: //segment load
-                /* Store value of registers b and c */
-                (void) nothing;
-
-                bv = um->registers[get_reg_i(curr_instruction, 'b')];
-                cv = um->registers[get_reg_i(curr_instruction, 'c')];
-                
-                if (bv >= (uint32_t)vector_length(um->segmented_memory) ||
-                    (Um_instruction *)vector_get(um->segmented_memory, bv) == 0) {
-                    fprintf(stderr, "Trying to load unmapped segment\n");
-                    exit(EXIT_FAILURE); /* Failure mode */
-                }
-                
-                num_instructions = uint32_vector_get(um->segment_lengths, bv);
-
-                if (cv > num_instructions) {
-                    fprintf(stderr, "Trying to access instruction out of bounds ");
-                    fprintf(stderr, "of mapped segment\n");
-                    exit(EXIT_FAILURE); /* Failure mode */
-                }
-                
-                Um_instruction inst_at_rbrc = 
-                ((Um_instruction *)vector_get(um->segmented_memory, bv))[cv];
-                
-                um->registers[get_reg_i(curr_instruction, 'a')] = inst_at_rbrc;
-                break;
-            case 2: //segment store
-                (void) nothing;
-                /* Store value of registers a, b, and c */
-                av = um->registers[get_reg_i(curr_instruction, 'a')];
-                bv = um->registers[get_reg_i(curr_instruction, 'b')];
-                cv = um->registers[get_reg_i(curr_instruction, 'c')];
-                
-                if (av >= (uint32_t)vector_length(um->segmented_memory) ||
-                    (Um_instruction *)vector_get(um->segmented_memory, av) == NULL) {
-                    fprintf(stderr, "Trying to store in unmapped segment\n");
-                    exit(EXIT_FAILURE); /* Failure mode */
-                }
-                
-                num_instructions = uint32_vector_get(um->segment_lengths, av);
-                
-                if (bv > num_instructions) {
-                    fprintf(stderr, "Trying to access instruction out of bounds ");
-                    fprintf(stderr, "of mapped segment\n");
-                    exit(EXIT_FAILURE); /* Failure mode */
-                }
-
-                ((Um_instruction *)vector_get(um->segmented_memory, av))[bv] = cv;
-                break;
-            case 3: //add
-                (void) nothing;
-                um->registers[get_reg_i(curr_instruction, 'a')] = (um->registers[get_reg_i(curr_instruction, 'b')] + um->registers[get_reg_i(curr_instruction, 'c')]) % twopow32;
-                break;
-            case 4: //multiply
-                (void) nothing;
-                um->registers[get_reg_i(curr_instruction, 'a')] = (um->registers[get_reg_i(curr_instruction,'b')] * um->registers[get_reg_i(curr_instruction, 'c')]) % twopow32;
-                break;
-            case 5: //divide
-                (void) nothing;
-                if (um->registers[get_reg_i(curr_instruction, 'c')] == 0) {
-                    fprintf(stderr, "Cannot divide by zero.\n");
-                    exit(EXIT_FAILURE); /* Failure mode */
-                }
-                um->registers[get_reg_i(curr_instruction, 'a')] = (um->registers[get_reg_i(curr_instruction, 'b')] / um->registers[get_reg_i(curr_instruction, 'c')]);
-                break;
-            case 6: //nand
-                (void) nothing;
-                um->registers[get_reg_i(curr_instruction, 'a')] = ~(um->registers[get_reg_i(curr_instruction, 'b')] & um->registers[get_reg_i(curr_instruction, 'c')]);
-                break;
-            case 7: //halt
-                (void) nothing;
-                int segmented_mem_len = vector_length(um->segmented_memory);
-                for (int i = 0; i < segmented_mem_len; i++) {
-                    free(vector_get(um->segmented_memory, i));
-                }
-                vector_free(um->segmented_memory);
-                uint32_vector_free(um->segment_lengths);
-                uint32_vector_free(um->unmappedID);
-                break;
-            case 8: //activate, map
-                (void) nothing;
-                /* Declares and initializes a new segment on the heap */
-                int num_words = um->registers[get_reg_i(curr_instruction, 'c')];
-
-                Um_instruction *new_segment = malloc(num_words * 4);
-                assert(new_segment != NULL);
-                
-                for (int i = 0; i < num_words; i++) {
-                    new_segment[i] = 0;
-                }
-                
-                /* Check if any segments have been unmapped whose IDs can be reused */
-                if (uint32_vector_length(um->unmappedID) != 0) {
-                    /* Maps segment with ID of previously unmapped segment */
-                    uint32_t reusableID = uint32_vector_get(um->unmappedID, 
-                                          uint32_vector_length(um->unmappedID) - 1);
-                    uint32_vector_remove_at(um->unmappedID, uint32_vector_length(um->unmappedID) - 1);
-                    vector_put(um->segmented_memory, reusableID, new_segment);
-                    uint32_vector_put(um->segment_lengths, reusableID, num_words);
-                    um->registers[get_reg_i(curr_instruction, 'b')] = reusableID;
-                } else {
-                    /* Maps segment with new ID */
-                    vector_addhi(um->segmented_memory, new_segment);
-                    uint32_vector_addhi(um->segment_lengths, num_words);
-                    um->registers[get_reg_i(curr_instruction, 'b')] = vector_length(um->segmented_memory) - 1;
-                }
-                break;
-            case 9: //inactivate, unmap
-                (void) nothing;
-                uint32_t unmappedID = um->registers[get_reg_i(curr_instruction, 'c')];
-            
-                if (unmappedID == 0 || 
-                    unmappedID >= (uint32_t)vector_length(um->segmented_memory)) {
-                    fprintf(stderr, "Can't unmap segment 0 or non-mapped segments\n");
-                    exit(EXIT_FAILURE); /* Failure mode */
-                }
-            
-                /* Unmaps the segment */
-                free(vector_get(um->segmented_memory, unmappedID));
-                vector_put(um->segmented_memory, unmappedID, NULL);
-            
-                uint32_vector_put(um->segment_lengths, unmappedID, 0);
-            
-                /* Adds the ID of the unmapped segment to the associated vector */
-                uint32_vector_addhi(um->unmappedID, unmappedID);
-                break;
-            case 10: //output
-                (void) nothing;
-                uint32_t c = um->registers[get_reg_i(curr_instruction, 'c')];
-                if (c > 255) {
-                /* Failure mode: unchecked runtime error */
-                    fprintf(stderr, "Register c not within bounds\n");
-                    exit(EXIT_FAILURE);
-                    }
-                putc(c, stdout);
-                break;
-            case 11: //input
-                (void) nothing;
-                int inputval = fgetc(stdin);
-            
-                /* Contract Violation */
-                if (inputval < -1 || inputval > 255) { /* EOF == -1 */
-                    fprintf(stderr, "Contract Violation: Must input value between 0 and");
-                    fprintf(stderr, " 255\n");
-                    exit(EXIT_FAILURE);
-                }
-            
-                if (inputval != EOF) {
-                    um->registers[get_reg_i(curr_instruction, 'c')] = inputval;
-                } else {
-                    um->registers[get_reg_i(curr_instruction, 'c')] = ~0;
-                }
-                break;
-            case 12: //load program
-                (void) nothing;
-                bv = um->registers[get_reg_i(curr_instruction, 'b')];
-            
-                if (bv >= (uint32_t)vector_length(um->segmented_memory) ||
-                    (Um_instruction *)vector_get(um->segmented_memory, bv) == NULL) {
-                        fprintf(stderr, "Trying to load unmapped segment\n");
-                        exit(EXIT_FAILURE); /* Failure mode */
-                    }
-            
-                if (bv != 0) {
-                /* Frees segment 0 */
-                free((Um_instruction *)vector_get(um->segmented_memory, 0));
-                
-                /* Duplicates segment at $r[B] */
-                uint32_t length_of_seq = uint32_vector_get(um->segment_lengths, bv);
-                
-                Um_instruction *new_segment = malloc(length_of_seq * 4);
-                assert(new_segment != NULL);
-                    
-                Um_instruction *old_segment = (Um_instruction *)vector_get(um->segmented_memory, bv);
-                for (unsigned i = 0; i < length_of_seq; i++) {
-                    new_segment[i] = old_segment[i];
-                }
-                
-                    /* Stores duplicate at $m[0] */
-                    vector_put(um->segmented_memory, 0, new_segment);
-                    uint32_vector_put(um->segment_lengths, 0, length_of_seq);
-                }
-            
-                um->program_counter = um->registers[get_reg_i(curr_instruction, 'c')];
-                um->program_counter--;
-                break;
-            case 13: //load value
-                (void) nothing;
-                uint32_t a = bp_get_u(curr_instruction, 3, 25);                
-                um->registers[a] = bp_get_u(curr_instruction, 25, 0);
-                break;
-            default: 
-                /* Failure mode: opcode out of range */
-                fprintf(stderr, "Invalid opcode\n");
-                exit(EXIT_FAILURE);
-                break;
+    if (um->stats != NULL) {
+        stats_cycle(um);
+    } else if (um->profile) {
+        profile_cycle(um);
+    } else {
+        run_cycle(um);
+    }
+}
+
+/* 
+ * execute_step
+ * Description:
+ * - Executes the single instruction at um->program_counter
+ * Parameters:
+ * - Pointer to an initialized universal machine struct (UM um)
+ * Effects:
+ * - Same as the instruction would have in execute_instr; the program 
+ *   counter is left at the next instruction to execute
+ * Returns:
+ * - 1 if the instruction was halt (the UM's memory has then been freed), 
+ *   0 otherwise
+ */
+int execute_step(UM um)
+{
+    return step_cycle(um);
+}
+
+
+/* 
+ * enable_stats
+ * Description:
+ * - Makes execute_instr count what the program does, for report_stats
+ * Parameters:
+ * - Pointer to a UM whose program has been loaded (UM um)
+ * Effects:
+ * - execute_instr runs the counting cycle from now on
+ * Returns:
+ * - None
+ */
+void enable_stats(UM um)
+{
+    Um_stats *stats = calloc(1, sizeof(Um_stats));
+    assert(stats != NULL);
+    um->stats = stats;
+
+    uint64_t slots = vector_length(um->segmented_memory);
+    for (uint64_t i = 0; i < slots; i++) {
+        value_type slot = vector_get(um->segmented_memory, i);
+        if (is_mapped(slot)) {
+            stats_mapped(stats, 1, segment_length(slot));
         }
-        um->program_counter++;
+    }
+
+    stats_segment_zero(um);
+    if (um->program_counter < stats->length) {
+        stats->entries[um->program_counter]++;
+        stats->run_start = um->program_counter;
     }
 }
 
+/* 
+ * stats_instructions
+ * Description:
+ * - Counts the instructions executed under enable_stats
+ * Parameters:
+ * - Pointer to a UM that has halted, before report_stats (UM um)
+ * Returns:
+ * - The number of instructions (uint64_t)
+ */
+uint64_t stats_instructions(UM um)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < 16; i++) {
+        total += um->stats->opcodes[i];
+    }
+    return total;
+}
+
+/* 
+ * report_stats
+ * Description:
+ * - Prints what the program did under enable_stats
+ * Parameters:
+ * - Pointer to a UM that has halted (UM um)
+ * - Where to print (FILE *out)
+ * - Wall clock time the program ran for, in seconds (double seconds)
+ * Effects:
+ * - Frees the counts; um->stats is NULL again
+ * Returns:
+ * - None
+ */
+void report_stats(UM um, FILE *out, double seconds)
+{
+    Um_stats *stats = um->stats;
+
+    uint64_t total = stats_instructions(um);
+    fprintf(out, "instructions: %llu in %.3f s (%.1f MIPS)\n", 
+            (unsigned long long)total, seconds,
+            seconds > 0 ? total / seconds / 1e6 : 0.0);
+    for (int i = 0; i < 15; i++) {
+        /* Opcodes 14 and 15 are both invalid */
+        uint64_t count = stats->opcodes[i] + (i == 14 ? stats->opcodes[15] : 0);
+        if (count != 0) {
+            fprintf(out, "  %-8s %15llu  %5.1f%%\n", opcode_names[i], 
+                    (unsigned long long)count, 100.0 * count / total);
+        }
+    }
+    fprintf(out, "maps: %llu, unmaps: %llu\n", 
+            (unsigned long long)stats->maps, 
+            (unsigned long long)stats->unmaps);
+    fprintf(out, "peak live segments: %llu, peak bytes mapped: %llu\n",
+            (unsigned long long)stats->peak_segments, 
+            (unsigned long long)stats->peak_bytes);
+    fprintf(out, "load program: %llu jumps within segment 0, %llu loads of "
+            "another segment\n", (unsigned long long)stats->loadp_jumps,
+            (unsigned long long)stats->loadp_copies);
+    fprintf(out, "most frequent pairs, each falling through to the next:\n");
+    report_sequences(out, &stats->pairs[0][0], 2, total);
+    fprintf(out, "most frequent triples:\n");
+    report_sequences(out, &stats->triples[0][0][0], 3, total);
+
+    free(stats->entries);
+    free(stats);
+    um->stats = NULL;
+}
+
 
 /************************** Helper Functions *********************************/
 
@@ -410,176 +624,623 @@ uint64_t bp_get_u(uint64_t word, unsigned width, unsigned lsb)
     return result;
 }
 
-
 /* 
+ * decode_instr
+ * Description:
+ * - Splits an instruction into its opcode, register indices and value
+ * Parameters:
+ * - The instruction (Um_instruction instruction)
+ * Effects:
+ * - None
+ * Returns:
+ * - The decoded instruction (Um_decoded). Register b and c are 0 and a holds
+ *   the destination register for load value; imm is 0 for every other 
+ *   instruction
+ */
+Um_decoded decode_instr(Um_instruction instruction)
+{
+    Um_decoded decoded;
+    decoded.handler = instruction >> 28;
+    
+    if (decoded.handler == LV) {
+        decoded.a = bp_get_u(instruction, 3, 25);
+        decoded.b = 0;
+        decoded.c = 0;
+        decoded.imm = bp_get_u(instruction, 25, 0);
+    } else {
+        decoded.a = get_reg_i(instruction, 'a');
+        decoded.b = get_reg_i(instruction, 'b');
+        decoded.c = get_reg_i(instruction, 'c');
+        decoded.imm = 0;
+    }
+    return decoded;
+}
+
+/*
+ * decode_entries
+ * Description:
+ * - Finds the handler each of some words of segment 0 runs in the 
+ *   specialized dispatch engine (see genHandlers.c): the start of an idiom
+ *   runs the whole idiom (see idiom_entry), a load value followed by one 
+ *   of the instructions in lv_fused runs both in one handler, anything 
+ *   else its handler for its registers if it has one, otherwise its 
+ *   opcode's generic handler
+ * Parameters:
+ * - Pointer to a UM with segment 0 decoded (UM um)
+ * - The words, from first up to (not including) end (uint32_t first, 
+ *   uint32_t end)
+ * Effects:
+ * - Sets their um->decoded_entries; after a word changes, call for the 
+ *   ENTRY_REACH words before it as well, which may run it too
+ * Returns:
+ * - None
+ */
+void decode_entries(UM um, uint32_t first, uint32_t end)
+{
+#ifdef SPECIALIZED_DISPATCH
+    Um_decoded *program = um->decoded_zero;
+    uint32_t length = segment_length(vector_get(um->segmented_memory, 0));
 
-DYNAMIC INT ARRAY.C
+    for (uint32_t i = first; i < end; i++) {
+        uint16_t entry = specialized_entries[program[i].handler];
+        if (entry != 0) {
+            entry += program[i].a * 64 + program[i].b * 8 + program[i].c;
+        } else {
+            entry = program[i].handler;
+        }
+        if (program[i].handler == LV && i + 1 < length &&
+            lv_fused[program[i + 1].handler] != 0) {
+            entry = lv_fused[program[i + 1].handler];
+        }
+        if (program[i].handler == NAND) {
+            uint16_t idiom = idiom_entry(program + i, length - i);
+            entry = idiom != 0 ? idiom : entry;
+        }
+        um->decoded_entries[i] = entry;
+    }
+#else
+    (void) um;
+    (void) first;
+    (void) end;
+#endif
+}
 
+/*
+ * idiom_entry
+ * Description:
+ * - Recognizes the operations UM compilers build out of nand, so the 
+ *   specialized engine can run each one at once:
+ *    - IDIOM_SUB: nand t, y, y; add d, x, t; lv t, 1; add d, t, d 
+ *      (d = x + ~y + 1 = x - y, and t = 1)
+ *    - IDIOM_AND: nand t, a, b; nand t, t, t (t = a & b)
+ *    - IDIOM_OR:  nand p, a, a; nand q, b, b; nand d, p, q 
+ *      (p = ~a, q = ~b, d = a | b)
+ *   Either add or the last nand may take its operands in either order. 
+ *   The registers must be such that every register the words write ends 
+ *   up as they would leave it, with each operand read before any of them 
+ *   is written: x and b can't be t or p, and d can't be t
+ * Parameters:
+ * - The first word, a nand (Um_decoded *words)
+ * - Words from there to the end of segment 0 (uint32_t length)
+ * Returns:
+ * - The idiom's dispatch table entry (uint16_t), 0 if the words aren't one
+ */
+#ifdef SPECIALIZED_DISPATCH
+uint16_t idiom_entry(Um_decoded *words, uint32_t length)
+{
+    Um_decoded first = words[0];
+    uint8_t t = first.a;
 
-*/
+    if (length >= 2 && words[1].handler == NAND && 
+        words[1].a == t && words[1].b == t && words[1].c == t) {
+        return IDIOM_AND;
+    }
+    if (first.b != first.c) {
+        return 0;
+    }
 
-uint32_vector uint32_vector_new() 
+    if (length >= 4 && words[1].handler == ADD && words[2].handler == LV &&
+        words[3].handler == ADD) {
+        Um_decoded add = words[1], last = words[3];
+        uint8_t d = add.a;
+        if ((add.b == t) != (add.c == t) && d != t && 
+            words[2].a == t && words[2].imm == 1 && last.a == d && 
+            ((last.b == t && last.c == d) || (last.b == d && last.c == t))) {
+            return IDIOM_SUB;
+        }
+    }
+
+    if (length >= 3 && words[1].handler == NAND && words[2].handler == NAND) {
+        Um_decoded second = words[1], last = words[2];
+        uint8_t q = second.a;
+        if (second.b == second.c && second.b != t && q != t &&
+            ((last.b == t && last.c == q) || (last.b == q && last.c == t))) {
+            return IDIOM_OR;
+        }
+    }
+    return 0;
+}
+#endif
+
+/* 
+ * decode_segment_zero
+ * Description:
+ * - Decodes every word of segment 0 into um->decoded_zero (and, for the
+ *   specialized dispatch engine, its entry into um->decoded_entries), 
+ *   followed by an invalid opcode, so running off the end of segment 0 
+ *   fails like any other invalid instruction
+ * Parameters:
+ * - Pointer to a UM with a loaded segment 0 (UM um)
+ * Effects:
+ * - Grows um->decoded_zero if segment 0 and the invalid opcode no longer 
+ *   fit and overwrites it with the decoded contents of segment 0
+ * Returns:
+ * - None
+ */
+void decode_segment_zero(UM um)
 {
-    uint32_vector v = (uint32_vector) malloc(sizeof(struct uint32_vector));
-    if (v == NULL) {
-        fprintf(stderr, "Not enough memory!");
-        abort();
+    Um_instruction *segment_zero = vector_get(um->segmented_memory, 0);
+    uint32_t length = segment_length(segment_zero);
+    
+    if (um->decoded_zero == NULL || length > um->decoded_capacity) {
+        free_decoded(um);
+        um->decoded_zero = huge_pages_alloc(((size_t)length + 1) * 
+                                            sizeof(Um_decoded));
+        assert(um->decoded_zero != NULL);
+#ifdef SPECIALIZED_DISPATCH
+        um->decoded_entries = huge_pages_alloc(((size_t)length + 1) * 
+                                               sizeof(uint16_t));
+        assert(um->decoded_entries != NULL);
+#endif
+        um->decoded_capacity = length;
     }
-    v->size = 0;
-    v->capacity = INITIAL_CAPACITY;
-    v->array = (uint32_t*) malloc(sizeof(int) * v->capacity);
-    if (v->array == NULL) {
-        fprintf(stderr, "Not enough memory!");
-        abort();
+    
+    for (uint32_t i = 0; i < length; i++) {
+        um->decoded_zero[i] = decode_instr(segment_zero[i]);
     }
-    return v;
+    um->decoded_zero[length] = decode_instr((Um_instruction)INVALID << 28);
+#ifdef SPECIALIZED_DISPATCH
+    decode_entries(um, 0, length);
+    um->decoded_entries[length] = INVALID;
+#endif
 }
 
-void uint32_vector_free(uint32_vector v) 
+/* 
+ * free_decoded
+ * Description:
+ * - Releases the decoded copy of segment 0 (and its dispatch table entries)
+ * Parameters:
+ * - Pointer to a UM (UM um)
+ * Effects:
+ * - um->decoded_zero no longer holds anything; the next 
+ *   decode_segment_zero allocates it again
+ * Returns:
+ * - None
+ */
+void free_decoded(UM um)
 {
-    assert(v);
-    free(v->array);
-    free(v);
+    huge_pages_release(um->decoded_zero, ((size_t)um->decoded_capacity + 1)
+                       * sizeof(Um_decoded));
+    huge_pages_release(um->decoded_entries, 
+                       ((size_t)um->decoded_capacity + 1) * sizeof(uint16_t));
+    um->decoded_zero = NULL;
+    um->decoded_entries = NULL;
+    um->decoded_capacity = 0;
 }
 
-void uint32_vector_addhi(uint32_vector v, uint32_t value) 
+/* 
+ * read_all
+ * Description:
+ * - Reads a file descriptor until end of file, for input whose size stat 
+ *   cannot tell. A read interrupted by a signal is retried
+ * Parameters:
+ * - The file descriptor (int fd)
+ * - Where to store the number of bytes read (size_t *size)
+ * Returns:
+ * - A malloc'd buffer holding the bytes; the caller frees it
+ */
+uint8_t *read_all(int fd, size_t *size)
 {
-    if (v->size >= v->capacity) {
-        int new_capacity = 2 * v->capacity;
-        uint32_t* new_array = (uint32_t*) malloc(sizeof(int)*new_capacity);
-        if (new_array == NULL) {
-            fprintf(stderr, "Not enough memory!");
-            abort();
+    size_t capacity = 1 << 16;
+    size_t used = 0;
+    uint8_t *buffer = malloc(capacity);
+    assert(buffer != NULL);
+    
+    for (;;) {
+        if (used == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            assert(buffer != NULL);
+        }
+        ssize_t got = read(fd, buffer + used, capacity - used);
+        if (got == 0) {
+            break;
         }
-        int vsize = v->size;
-        for(int i = 0; i < vsize; i++) {
-            new_array[i] = v->array[i];
+        if (got < 0 && errno == EINTR) {
+            continue;
         }
-        free(v->array);
-        v->array = new_array;
-        v->capacity = new_capacity;
+        assert(got > 0);
+        used += got;
     }
-    v->array[v->size++] = value;
+    
+    *size = used;
+    return buffer;
 }
 
-uint32_t uint32_vector_get(uint32_vector v, int i) 
+/* 
+ * load_words
+ * Description:
+ * - Converts big-endian words to host order in one pass. gcc vectorizes 
+ *   the loop; target_clones builds it for SSSE3 and AVX2 as well, picked 
+ *   at startup by the CPU the UM runs on.
+ * Parameters:
+ * - Where to store the words (Um_instruction *words)
+ * - The bytes to convert (const uint8_t *bytes)
+ * - Number of words (uint32_t count)
+ * Returns:
+ * - None
+ */
+__attribute__((target_clones("avx2", "ssse3", "default")))
+void load_words(Um_instruction *words, const uint8_t *bytes, uint32_t count)
 {
-    if (i >= v->size) {
-        fprintf(stderr, "Out of index!");
-        abort();
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t word;
+        memcpy(&word, bytes + 4 * (size_t)i, sizeof(word));
+        words[i] = __builtin_bswap32(word);
     }
-    return v->array[i];
 }
-    
-void uint32_vector_put(uint32_vector v, int i, uint32_t value) 
+
+/* 
+ * is_mapped
+ * Description:
+ * - Tells a segment apart from the slot of an unmapped ID. Segments are 
+ *   word aligned, so the low bit of an unmapped slot is set to mark it.
+ * Parameters:
+ * - An entry of um->segmented_memory (value_type slot)
+ * Returns:
+ * - Nonzero if the slot holds a segment
+ */
+int is_mapped(value_type slot)
 {
-    if (i >= v->size) {
-        fprintf(stderr, "Out of index!");
-        abort();
-    }
-    v->array[i] = value;
+    return ((uintptr_t)slot & 1) == 0;
 }
 
-void uint32_vector_add_at(uint32_vector v, int i, uint32_t value) 
+/* 
+ * unmapped_slot
+ * Description:
+ * - Builds the entry stored in the slot of an unmapped ID. With 
+ *   CHECKS=trap it is an odd address in the guard region, so reading
+ *   through it faults (see trapChecks.c)
+ * Parameters:
+ * - The unmapped ID to reuse after this one, 0 if none (uint32_t next)
+ * Returns:
+ * - The tagged entry (value_type)
+ */
+value_type unmapped_slot(uint32_t next)
 {
-    if (i >= v->size) {
-        fprintf(stderr, "Out of index!");
-        abort();
+#ifdef TRAP_CHECKS
+    return (value_type)(trap_guard + (((uintptr_t)next << 1) | 1));
+#else
+    return (value_type)(((uintptr_t)next << 1) | 1);
+#endif
+}
+
+/* 
+ * next_unmapped
+ * Description:
+ * - Reads the link out of the slot of an unmapped ID
+ * Parameters:
+ * - The slot (value_type slot)
+ * Returns:
+ * - The unmapped ID to reuse after it, 0 if none
+ */
+uint32_t next_unmapped(value_type slot)
+{
+#ifdef TRAP_CHECKS
+    return ((char *)slot - trap_guard) >> 1;
+#else
+    return (uintptr_t)slot >> 1;
+#endif
+}
+
+/* 
+ * segment_is_mapped
+ * Description:
+ * - Tells whether an ID is that of a mapped segment: its slot in the table
+ *   holds a segment or, with SEGMENTS=arena, a mapped segment starts at
+ *   that offset in the arena (see segmentPool.c)
+ * Parameters:
+ * - The UM and the ID (UM um, uint32_t id)
+ * Returns:
+ * - Nonzero if it is; segment 0 always is
+ */
+int segment_is_mapped(UM um, uint32_t id)
+{
+#ifdef ARENA_SEGMENTS
+    (void) um;
+    return id == 0 || arena_is_mapped(id);
+#else
+    return id < vector_length(um->segmented_memory) &&
+           is_mapped(vector_get(um->segmented_memory, id));
+#endif
+}
+
+/* 
+ * segment_get
+ * Description:
+ * - Finds the segment with an ID. With SEGMENTS=arena only segment 0 is
+ *   in the table; any other segment is at its ID's offset in the arena
+ * Parameters:
+ * - The UM and the ID of a mapped segment (UM um, uint32_t id)
+ * Returns:
+ * - The segment (value_type)
+ */
+value_type segment_get(UM um, uint32_t id)
+{
+#ifdef ARENA_SEGMENTS
+    return id == 0 ? um->segmented_memory->array[0] : segment_arena + id;
+#else
+    return vector_get(um->segmented_memory, id);
+#endif
+}
+
+/* 
+ * stats_fold
+ * Description:
+ * - Adds the instructions executed since the last fold to the opcode counts
+ *   of um->stats, from the jumps that landed on each word of segment 0
+ *   (stats->entries). Each word ran once for every jump landing on it, plus
+ *   as often as the word before it if that one falls through (anything but
+ *   halt, load program or an invalid opcode).
+ * Parameters:
+ * - Pointer to a running UM with stats enabled (UM um)
+ * - The words to fold, from first up to (not including) end; the word
+ *   before first must not fall through, nor end - 1 unless it is the last
+ *   word (uint32_t first, uint32_t end)
+ * - The next word to execute if the cycle is part way through a run of 
+ *   words that fall through, UINT32_MAX if it just jumped or halted 
+ *   (uint32_t resume)
+ * Effects:
+ * - Those words' entries start over, from the resume point if it is one
+ *   of them; call before their opcodes change or segment 0 is replaced
+ * Returns:
+ * - None
+ */
+void stats_fold(UM um, uint32_t first, uint32_t end, uint32_t resume)
+{
+    Um_stats *stats = um->stats;
+    uint64_t *entries = stats->entries;
+    int resumes = resume >= first && resume < end;
+
+    /* The run in progress only got as far as resume; unsigned wraparound
+       cancels this out once the word before resume is added in */
+    if (resumes) {
+        entries[resume]--;
     }
-    if (v->size >= v->capacity) {
-        int new_capacity = 2 * v->capacity;
-        uint32_t* new_array = (uint32_t*) malloc(sizeof(int)*new_capacity);
-        if (new_array == NULL) {
-            fprintf(stderr, "Not enough memory!");
-            abort();
-        }
-        int vsize = v->size;
-        for(int i = 0; i < vsize; i++) {
-            new_array[i] = v->array[i];
+
+    /* Word i - 1 falls through to i as often as i - 1 ran, and i - 2 
+       through i - 1 to i as often as i - 2 ran, less the run in progress
+       if it got to the first of them but not yet to i */
+    uint64_t executed = 0, executed_before = 0;
+    uint8_t previous = HALT, before = HALT;
+    for (uint32_t i = first; i < end; i++) {
+        uint8_t handler = um->decoded_zero[i].handler;
+        uint64_t last = executed;
+        executed = entries[i] + (falls_through(previous) ? executed : 0);
+        stats->opcodes[handler] += executed;
+        if (falls_through(previous)) {
+            stats->pairs[previous][handler] += 
+                last - stopped_between(stats, i - 1, i, resume);
+            if (falls_through(before)) {
+                stats->triples[before][previous][handler] += 
+                    executed_before - stopped_between(stats, i - 2, i, resume);
+            }
         }
-        free(v->array);
-        v->array = new_array;
-        v->capacity = new_capacity;
+        executed_before = last;
+        before = previous;
+        previous = handler;
+        entries[i] = 0;
     }
-    int vsize = v->size;
-    for(int j = vsize; j > i; j--) {
-        v->array[j] = v->array[j-1];
+
+    if (resumes) {
+        entries[resume] = 1;
     }
-    v->array[i] = value;
-    v->size++;
 }
 
-uint32_t uint32_vector_remove_at(uint32_vector v, int i) 
+/* 
+ * stats_word_changing
+ * Description:
+ * - Folds the words whose counts depend on a word of segment 0 that a 
+ *   store is about to give a new opcode: the run of words falling through
+ *   to it, and the run after it, which it may start falling through to
+ *   or stop falling through to
+ * Parameters:
+ * - Pointer to a running UM with stats enabled (UM um)
+ * - The word being changed (uint32_t word)
+ * - The next word to execute, after the store (uint32_t pc)
+ * Effects:
+ * - Call before the word is redecoded; does nothing for a word that 
+ *   hasn't run since segment 0 was loaded
+ * Returns:
+ * - None
+ */
+void stats_word_changing(UM um, uint32_t word, uint32_t pc)
 {
-    if (i >= v->size) {
-        fprintf(stderr, "Out of index!");
-        abort();
+    Um_decoded *program = um->decoded_zero;
+    uint32_t length = um->stats->length;
+
+    /* Every run so far ended at a load program no later than reached, so
+       a word past it (and past the run in progress) has never run, and 
+       the words before it don't depend on it: nothing to fold. This is 
+       what keeps a program unpacking itself into segment 0 linear. */
+    if (word > um->stats->reached && word >= pc) {
+        return;
     }
-    int ret = v->array[i];
-    int vsize = v->size;
-    
-    for(int j = i + 1; j < vsize; j++) {
-        v->array[j-1] = v->array[j];
+
+    uint32_t first = word;
+    while (first > 0 && falls_through(program[first - 1].handler)) {
+        first--;
     }
-    v->size--;
-    if (4 * vsize < v->capacity) {
-        if (v->capacity > INITIAL_CAPACITY) {
-            int new_capacity = v->capacity / 2;
-            uint32_t* new_array = (uint32_t*) 
-            malloc(sizeof(int)*new_capacity);
-            if (new_array == NULL) {
-                fprintf(stderr, "Not enough memory!");
-                abort();
-            }
-            int vsize = min(v->size, new_capacity);
-            for(int i = 0; i < vsize; i++) {
-                new_array[i] = v->array[i];
-            }
-            free(v->array);
-            v->array = new_array;
-            v->capacity = new_capacity;
-            v->size = vsize;
-        }
+    uint32_t end = word + 1;
+    while (end < length && falls_through(program[end].handler)) {
+        end++;
     }
-    return ret;
+    if (end < length) {
+        end++;
+    }
+
+    stats_fold(um, first, end, pc);
 }
 
-int uint32_vector_is_empty(uint32_vector v) 
+/* 
+ * stats_segment_zero
+ * Description:
+ * - Sizes um->stats->entries for a new segment 0, with no jumps counted
+ * Parameters:
+ * - Pointer to a UM with stats enabled and segment 0 decoded (UM um)
+ * Returns:
+ * - None
+ */
+void stats_segment_zero(UM um)
 {
-    return v->size == 0;
+    Um_stats *stats = um->stats;
+    stats->length = segment_length(vector_get(um->segmented_memory, 0));
+    stats->reached = 0;
+    free(stats->entries);
+    stats->entries = calloc((size_t)stats->length + 1, sizeof(uint64_t));
+    assert(stats->entries != NULL);
 }
 
-int uint32_vector_length(uint32_vector v) 
+/* 
+ * stats_mapped
+ * Description:
+ * - Tracks the live segments and their bytes, and their peaks
+ * Parameters:
+ * - The stats (Um_stats *stats)
+ * - Change in the number of live segments (int64_t segments)
+ * - Change in the number of words they hold (int64_t words)
+ * Returns:
+ * - None
+ */
+void stats_mapped(Um_stats *stats, int64_t segments, int64_t words)
 {
-    return v->size;
+    stats->live_segments += segments;
+    stats->bytes_mapped += words * (int64_t)sizeof(uint32_t);
+    if (stats->live_segments > stats->peak_segments) {
+        stats->peak_segments = stats->live_segments;
+    }
+    if (stats->bytes_mapped > stats->peak_bytes) {
+        stats->peak_bytes = stats->bytes_mapped;
+    }
 }
 
-void uint32_vector_clear(uint32_vector v) 
+/* 
+ * falls_through
+ * Description:
+ * - Tells whether the next word runs after an instruction, barring failure
+ * Parameters:
+ * - The instruction's opcode (uint8_t handler)
+ * Returns:
+ * - 0 for halt, load program and invalid opcodes, 1 otherwise
+ */
+int falls_through(uint8_t handler)
 {
-    v->size = 0;
-    int vcapacity = v->capacity;
-    while (vcapacity > INITIAL_CAPACITY) {
-        if (v->capacity <= INITIAL_CAPACITY) {
-            return;
-        }
-        int new_capacity = v->capacity / 2;
-        uint32_t* new_array = (uint32_t*) 
-        malloc(sizeof(int)*new_capacity);
-        if (new_array == NULL) {
-            fprintf(stderr, "Not enough memory!");
-            abort();
-        }
-        int vsize = min(v->size, new_capacity);
-        for(int i = 0; i < vsize; i++) {
-            new_array[i] = v->array[i];
+    return handler != HALT && handler != LOADP && handler <= LV;
+}
+
+/* 
+ * report_sequences
+ * Description:
+ * - Prints the most frequent opcode sequences of one length from --stats
+ * Parameters:
+ * - Where to print (FILE *out)
+ * - Counts by opcode sequence, the first opcode varying slowest 
+ *   (uint64_t *counts)
+ * - Length of the sequences (int opcodes)
+ * - Instructions executed, for percentages (uint64_t total)
+ * Returns:
+ * - None
+ */
+void report_sequences(FILE *out, uint64_t *counts, int opcodes, 
+                      uint64_t total)
+{
+    int size = 1 << (4 * opcodes);
+    uint64_t **order = malloc(size * sizeof(uint64_t *));
+    assert(order != NULL);
+    for (int i = 0; i < size; i++) {
+        order[i] = &counts[i];
+    }
+    qsort(order, size, sizeof(uint64_t *), compare_counts);
+
+    for (int i = 0; i < size && i < TOP_SEQUENCES && *order[i] != 0; i++) {
+        int sequence = order[i] - counts;
+        char names[32] = "";
+        for (int j = opcodes - 1; j >= 0; j--) {
+            strcat(names, opcode_names[(sequence >> (4 * j)) & 15]);
+            strcat(names, j > 0 ? " " : "");
         }
-        free(v->array);
-        v->array = new_array;
-        v->capacity = new_capacity;
-        v->size = vsize;
+        fprintf(out, "  %-20s %15llu  %5.1f%%\n", names, 
+                (unsigned long long)*order[i], 100.0 * *order[i] / total);
     }
+    free(order);
 }
 
+/* 
+ * compare_counts
+ * Description:
+ * - Orders pointers to counts from the largest count down, for qsort
+ * Parameters:
+ * - Two pointers to pointers to counts (const void *a, const void *b)
+ * Returns:
+ * - Negative if a's count is larger, positive if b's is, else 0
+ */
+int compare_counts(const void *a, const void *b)
+{
+    uint64_t x = **(uint64_t *const *)a;
+    uint64_t y = **(uint64_t *const *)b;
+    return (x < y) - (x > y);
+}
+
+/* 
+ * stopped_between
+ * Description:
+ * - Tells whether the run in progress, stopped at resume, ran a word but 
+ *   has not yet fallen through to a later one; see stats_fold
+ * Parameters:
+ * - The stats (Um_stats *stats)
+ * - The two words, in one run of words falling through (uint32_t from, 
+ *   uint32_t to)
+ * - The next word to execute, as for stats_fold (uint32_t resume)
+ * Returns:
+ * - 1 if so, 0 if not
+ */
+int stopped_between(Um_stats *stats, uint32_t from, uint32_t to, 
+                    uint32_t resume)
+{
+    return stats->run_start <= from && from < resume && resume <= to;
+}
+
+/* 
+ * unshare_segment_zero
+ * Description:
+ * - Gives segment 0 its own copy of the words it shares with the segment it
+ *   was loaded from, before either of them is written
+ * Parameters:
+ * - Pointer to a UM whose segment 0 is shared (UM um)
+ * Effects:
+ * - $m[0] points to a new copy of its words and um->zero_shared_with is 0
+ * Returns:
+ * - None
+ */
+void unshare_segment_zero(UM um)
+{
+    Um_instruction *copy = segment_pool_copy(vector_get(um->segmented_memory, 0));
+    
+    vector_put(um->segmented_memory, 0, copy);
+    um->zero_shared_with = 0;
+}
+
+
 /*
 
 DYNAMIC ARRAY . C
@@ -596,43 +1257,70 @@ vector vector_new()
         abort();
     }
     v->size = 0;
-    v->capacity = INITIAL_CAPACITY;
-    v->array = (value_type*) malloc(sizeof(value_type) * v->capacity);
-    if (v->array == NULL) {
+    v->capacity = 0;
+    /* Reserved for every possible ID and committed as it grows, so it 
+       never moves and growing it copies nothing */
+#ifdef TRAP_CHECKS
+    v->array = trap_reserve(TABLE_BYTES);
+#else
+    v->array = mmap(NULL, TABLE_BYTES, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (v->array == MAP_FAILED) {
         fprintf(stderr, "Not enough memory!");
         abort();
     }
+#endif
+    if (huge_pages) {
+        madvise(v->array, TABLE_BYTES, MADV_HUGEPAGE);
+    }
+    vector_commit(v, INITIAL_CAPACITY);
     return v;
 }
 
 void vector_free(vector v) 
 {
     assert(v);
-    free(v->array);
+#ifdef TRAP_CHECKS
+    trap_release(v->array, TABLE_BYTES);
+#else
+    munmap(v->array, TABLE_BYTES);
+#endif
     free(v);
 }
 
+/* Makes the slots up to a new capacity, rounded up to a whole page, 
+   usable. With CHECKS=trap, slots committed but past the length read as
+   unmapped */
+void vector_commit(vector v, uint64_t capacity)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t bytes = (capacity * sizeof(value_type) + page - 1) & ~(page - 1);
+    if (mprotect(v->array, bytes, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "Not enough memory!");
+        abort();
+    }
+    capacity = bytes / sizeof(value_type);
+#ifdef TRAP_CHECKS
+    for (uint64_t i = v->capacity; i < capacity; i++) {
+        v->array[i] = unmapped_slot(0);
+    }
+#endif
+    v->capacity = capacity;
+}
+
 void vector_addhi(vector v, value_type value) 
 {
     if (v->size >= v->capacity) {
-        int new_capacity = 2 * v->capacity;
-        value_type* new_array = (value_type*) malloc(sizeof(value_type)*new_capacity);
-        if (new_array == NULL) {
-            fprintf(stderr, "Not enough memory!");
-            abort();
-        }
-        int vsize = v->size;
-        for(int i = 0; i < vsize; i++) {
-            new_array[i] = v->array[i];
+        if (v->size == TABLE_SLOTS) {
+            fprintf(stderr, "Every segment ID is in use\n");
+            exit(EXIT_FAILURE);
         }
-        free(v->array);
-        v->array = new_array;
-        v->capacity = new_capacity;
+        vector_commit(v, min(2 * v->capacity, TABLE_SLOTS));
     }
     v->array[v->size++] = value;
 }
 
-value_type vector_get(vector v, int i) 
+value_type vector_get(vector v, uint32_t i) 
 {
     if (i >= v->size) {
         fprintf(stderr, "Out of index!");
@@ -641,7 +1329,7 @@ value_type vector_get(vector v, int i)
     return v->array[i];
 }
     
-void vector_put(vector v, int i, value_type value) 
+void vector_put(vector v, uint32_t i, value_type value) 
 {
     if (i >= v->size) {
         fprintf(stderr, "Out of index!");
@@ -650,66 +1338,30 @@ void vector_put(vector v, int i, value_type value)
     v->array[i] = value;
 }
 
-void vector_add_at(vector v, int i, value_type value) 
+void vector_add_at(vector v, uint32_t i, value_type value) 
 {
     if (i >= v->size) {
         fprintf(stderr, "Out of index!");
         abort();
     }
-    if (v->size >= v->capacity) {
-        int new_capacity = 2 * v->capacity;
-        value_type* new_array = (value_type*) malloc(sizeof(value_type)*new_capacity);
-        if (new_array == NULL) {
-            fprintf(stderr, "Not enough memory!");
-            abort();
-        }
-        int vsize = v->size;
-        for(int i = 0; i < vsize; i++) {
-            new_array[i] = v->array[i];
-        }
-        free(v->array);
-        v->array = new_array;
-        v->capacity = new_capacity;
-    }
-    int vsize = v->size;
-    for(int j = vsize; j>i; j--) {
+    vector_addhi(v, value);
+    for (uint64_t j = v->size - 1; j > i; j--) {
         v->array[j] = v->array[j-1];
     }
     v->array[i] = value;
-    v->size++;
 }
 
-value_type vector_remove_at(vector v, int i) 
+value_type vector_remove_at(vector v, uint32_t i) 
 {
     if (i >= v->size) {
         fprintf(stderr, "Out of index!");
         abort();
     }
     value_type ret = v->array[i];
-    int vsize = v->size;
-    for(int j = i + 1; j < vsize; j++) {
+    for (uint64_t j = (uint64_t)i + 1; j < v->size; j++) {
         v->array[j-1] = v->array[j];
     }
     v->size--;
-    if (4 * v->size < v->capacity) {
-        if (v->capacity > INITIAL_CAPACITY) {
-            int new_capacity = v->capacity / 2;
-            value_type* new_array = (value_type*) 
-            malloc(sizeof(value_type)*new_capacity);
-            if (new_array == NULL) {
-                fprintf(stderr, "Not enough memory!");
-                abort();
-            }
-            int vsize = min(v->size, new_capacity);
-            for(int i = 0; i < vsize; i++) {
-                new_array[i] = v->array[i];
-            }
-            free(v->array);
-            v->array = new_array;
-            v->capacity = new_capacity;
-            v->size = vsize;
-        }
-    }
     return ret;
 }
 
@@ -718,7 +1370,7 @@ int vector_is_empty(vector v)
     return v->size == 0;
 }
 
-int vector_length(vector v) 
+uint64_t vector_length(vector v) 
 {
     return v->size;
 }
@@ -726,27 +1378,6 @@ int vector_length(vector v)
 void vector_clear(vector v) 
 {
     v->size = 0;
-    int vcapacity = v->capacity;
-    while (vcapacity > INITIAL_CAPACITY) {
-        if (v->capacity <= INITIAL_CAPACITY) {
-            return;
-        }
-        int new_capacity = v->capacity / 2;
-        value_type* new_array = (value_type*) 
-        malloc(sizeof(value_type)*new_capacity);
-        if (new_array == NULL) {
-            fprintf(stderr, "Not enough memory!");
-            abort();
-        }
-        int vsize = min(v->size, new_capacity);
-        for(int i = 0; i < vsize; i++) {
-            new_array[i] = v->array[i];
-        }
-        free(v->array);
-        v->array = new_array;
-        v->capacity = new_capacity;
-        v->size = vsize;
-    }
 }
 
 
@@ -17,36 +17,73 @@
 
 typedef uint32_t* value_type;
 
- struct uint32_vector {
-     uint32_t* array;
-     int size;
-     int capacity;
- };
-
- struct _vector {
+struct _vector {
      value_type* array;
-     int size;
-     int capacity;
+     uint64_t size;     /* up to 2^32, one slot per segment ID */
+     uint64_t capacity; /* slots committed, see vector_commit */
  };
 
 
  typedef uint32_t Um_instruction;
- typedef struct uint32_vector* uint32_vector;
  typedef struct _vector* vector;
+
+ /* One pre-decoded word of segment 0 */
+ typedef struct Um_decoded {
+     uint8_t handler;  /* opcode, indexes the dispatch table */
+     uint8_t a, b, c;  /* register indices */
+     uint32_t imm;     /* value of a load value instruction */
+ } Um_decoded;
  
+ /* What --stats counts while the UM runs; see enable_stats */
+ typedef struct Um_stats {
+     uint64_t *entries;     /* per word of segment 0: jumps that landed there */
+     uint32_t length;       /* words in entries */
+     uint32_t reached;      /* last load program that ran in segment 0 */
+     uint32_t run_start;    /* word the run in progress started at */
+     uint64_t opcodes[16];  /* instructions executed, by opcode */
+     uint64_t pairs[16][16];        /* by opcodes of a word and the word it */
+     uint64_t triples[16][16][16];  /* falls through to, and the next one */
+     uint64_t maps, unmaps;
+     uint64_t live_segments, peak_segments;
+     uint64_t bytes_mapped, peak_bytes;
+     uint64_t loadp_jumps;  /* load program from segment 0 */
+     uint64_t loadp_copies; /* load program from another segment */
+ } Um_stats;
+
  struct UM {
      Um_instruction registers[8]; //
-     vector segmented_memory; //
-     uint32_vector segment_lengths; //
-     uint32_vector unmappedID; //
+     vector segmented_memory; /* lengths sit in the word before each */
+     uint32_t unmapped_head; /* last unmapped ID, 0 if none to reuse */
      uint32_t program_counter; 
+     Um_decoded *decoded_zero; /* segment 0, decoded once */
+     uint32_t decoded_capacity;
+     uint16_t *decoded_entries; /* DISPATCH=specialized: dispatch table
+                                   entry of each word of decoded_zero */
+     uint32_t zero_shared_with; /* segment sharing $m[0]'s words, 0 if none */
+     char *snapshot_at_input; /* snapshot file to write at the first input */
+     Um_stats *stats; /* NULL unless enable_stats was called */
+     int profile; /* 1 to run the cycle that calls profile_sample */
  };
  
  typedef struct UM *UM;
 
  void execute_instr(UM um);
+ int execute_step(UM um);
+ Um_decoded decode_instr(Um_instruction instruction);
+ void decode_entries(UM um, uint32_t first, uint32_t end);
+
+ /* Words of segment 0 before a changed word whose entries may depend on 
+    it: the longest idiom decode_entries recognizes is four words */
+ #define ENTRY_REACH 3
+
  UM initialize_UM();
+ void free_UM(UM um);
  void load_mem(char *filename, UM um);
+ void save_snapshot(UM um, uint32_t pc);
+ void load_snapshot(char *filename, UM um);
+ void enable_stats(UM um);
+ uint64_t stats_instructions(UM um);
+ void report_stats(UM um, FILE *out, double seconds);
 
 
  #endif
\ No newline at end of file
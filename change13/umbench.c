@@ -0,0 +1,431 @@
+/* umbench.c
+ * HW06: um
+ * Lucas Maley and Colby Cho
+ * Benchmark runner behind "make bench": runs every workload of umbin a
+ * number of times under a UM, checks each run's output against the golden
+ * output, and prints the median wall time, instructions per second and
+ * peak resident set size of each workload as JSON on standard output. The
+ * UM instruction counts are not measured: they are the counts of one
+ * "um --stats" run, kept in the workloads table as reference_instructions.
+ *
+ * Usage: umbench [-n runs] [-c commit] [-w workload,...] [-f json|csv]
+ *                [-l label] [-p] um [um options...]
+ *  -w  runs only the named workloads
+ *  -f  csv prints one line per workload (see csv_header) instead of JSON,
+ *      with the label in the first column, so several UMs can be compared
+ *  -p  also counts the x86 instructions and cache misses of each run with
+ *      "perf stat"
+ * Paths are relative to the directory holding this file.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* One program with its scripted input and golden output */
+typedef struct Workload {
+    const char *name;
+    const char *program;
+    const char *input;         /* NULL for no input at all */
+    const char *golden;
+    /* UM instructions "um --stats" counted once with this input; the 
+       programs are deterministic, so every run executes this many */
+    unsigned long long reference_instructions;
+} Workload;
+
+static const Workload workloads[] = {
+    { "midmark", "../umbin/midmark.um", NULL,
+      "bench/midmark.out", 85070522ull },
+    { "sandmark", "../umbin/sandmark.umz", NULL,
+      "../umbin/sandmark.out", 2113497561ull },
+    /* umbin/advent.umz is damaged; umbincopy has a good one */
+    { "advent", "../umbincopy/advent.umz", "../adventsol.txt",
+      "bench/advent.out", 780719004ull },
+    { "codex", "../umbin/codex.umz", "bench/codex.in",
+      "bench/codex.out", 1935140359ull },
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+#define MAX_RUNS 100
+
+/* What one run of a workload measured */
+typedef struct Run {
+    double seconds;  /* wall clock */
+    long peak_kb;    /* peak resident set size */
+    double cpu_instructions; /* from perf stat, -1 if not counted */
+    double cache_misses;     /* from perf stat, -1 if not counted */
+    int ok;          /* exited normally with the golden output */
+} Run;
+
+/* What the command line asked for */
+typedef struct Bench_options {
+    int runs;
+    const char *commit;   /* NULL if not given */
+    const char *only;     /* -w: comma separated workloads, NULL for all */
+    int csv;
+    const char *label;
+    int perf;
+    char **um_argv;       /* the UM and its options */
+    int um_argc;
+} Bench_options;
+
+static const char csv_header[] = "label,workload,verified,median_seconds,"
+    "min_seconds,reference_instructions,instructions_per_second,peak_rss_kb,"
+    "cpu_instructions,cache_misses";
+
+/********************* Private Function Declarations *************************/
+static Bench_options parse_options(int argc, char **argv);
+static int selected(const char *only, const char *name);
+static Run run_once(const Workload *workload, Bench_options *options);
+static void read_perf(FILE *counters, Run *run);
+static int same_output(FILE *output, const char *golden);
+static int compare_doubles(const void *a, const void *b);
+
+/************************** Function Definitions *****************************/
+
+int main(int argc, char **argv)
+{
+    Bench_options options = parse_options(argc, argv);
+
+    if (options.csv) {
+        printf("%s\n", csv_header);
+    } else {
+        printf("{\n  \"commit\": \"%s\",\n  \"label\": \"%s\",\n"
+               "  \"um\": \"", options.commit ? options.commit : "",
+               options.label);
+        for (int j = 0; j < options.um_argc; j++) {
+            printf("%s%s", j ? " " : "", options.um_argv[j]);
+        }
+        printf("\",\n  \"runs\": %d,\n  \"workloads\": [", options.runs);
+    }
+
+    int failed = 0, printed = 0;
+    for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+        const Workload *workload = &workloads[w];
+        if (!selected(options.only, workload->name)) {
+            continue;
+        }
+
+        double seconds[MAX_RUNS];
+        long peak_kb = 0;
+        double cpu_instructions = 0, cache_misses = 0;
+        int cpu_runs = 0, miss_runs = 0;
+        int ok = 1;
+
+        for (int r = 0; r < options.runs; r++) {
+            fprintf(stderr, "%s %s: run %d of %d\n", options.label,
+                    workload->name, r + 1, options.runs);
+            Run run = run_once(workload, &options);
+            seconds[r] = run.seconds;
+            ok = ok && run.ok;
+            if (run.peak_kb > peak_kb) {
+                peak_kb = run.peak_kb;
+            }
+            if (run.cpu_instructions >= 0) {
+                cpu_instructions += run.cpu_instructions;
+                cpu_runs++;
+            }
+            if (run.cache_misses >= 0) {
+                cache_misses += run.cache_misses;
+                miss_runs++;
+            }
+        }
+        qsort(seconds, options.runs, sizeof(double), compare_doubles);
+        int mid = options.runs / 2;
+        double median = options.runs % 2 ? seconds[mid]
+                        : (seconds[mid - 1] + seconds[mid]) / 2;
+
+        /* perf stat's counts are averaged over the runs it counted; empty 
+           (or null) without -p or if perf counted none of them */
+        char cpu[32] = "", misses[32] = "";
+        if (cpu_runs > 0) {
+            snprintf(cpu, sizeof(cpu), "%.0f", cpu_instructions / cpu_runs);
+        }
+        if (miss_runs > 0) {
+            snprintf(misses, sizeof(misses), "%.0f", 
+                     cache_misses / miss_runs);
+        }
+
+        if (options.csv) {
+            printf("%s,%s,%s,%.4f,%.4f,%llu,%.0f,%ld,%s,%s\n", 
+                   options.label, workload->name, ok ? "true" : "false", 
+                   median, seconds[0], workload->reference_instructions,
+                   workload->reference_instructions / median, peak_kb, cpu,
+                   misses);
+        } else {
+            printf("%s\n    { \"name\": \"%s\", \"verified\": %s, "
+                   "\"median_seconds\": %.4f, \"min_seconds\": %.4f, "
+                   "\"reference_instructions\": %llu, "
+                   "\"instructions_per_second\": %.0f, "
+                   "\"peak_rss_kb\": %ld, \"cpu_instructions\": %s, "
+                   "\"cache_misses\": %s }", printed ? "," : "",
+                   workload->name, ok ? "true" : "false", median, 
+                   seconds[0], workload->reference_instructions,
+                   workload->reference_instructions / median, peak_kb, 
+                   cpu[0] ? cpu : "null", misses[0] ? misses : "null");
+        }
+        fflush(stdout);
+        printed++;
+        failed = failed || !ok;
+    }
+    if (!options.csv) {
+        printf("\n  ]\n}\n");
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/************************** Helper Functions *********************************/
+
+/*
+ * parse_options
+ * Description:
+ * - Reads the command line (see the top of this file)
+ * Parameters:
+ * - Number of arguments and the arguments (int argc, char **argv)
+ * Effects:
+ * - Prints the usage and exits if the command line is wrong
+ * Returns:
+ * - The options (Bench_options)
+ */
+Bench_options parse_options(int argc, char **argv)
+{
+    Bench_options options = { 5, NULL, NULL, 0, "um", 0, NULL, 0 };
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "-p") == 0) {
+            options.perf = 1;
+        } else if (strcmp(argv[i], "-n") == 0 && has_value) {
+            options.runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && has_value) {
+            options.commit = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && has_value) {
+            options.only = argv[++i];
+        } else if (strcmp(argv[i], "-l") == 0 && has_value) {
+            options.label = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0 && has_value) {
+            options.csv = strcmp(argv[++i], "csv") == 0;
+            if (!options.csv && strcmp(argv[i], "json") != 0) {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+
+    /* Every workload named by -w must exist */
+    int known = 0;
+    for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+        known += selected(options.only, workloads[w].name);
+    }
+    int wanted = 1;
+    for (const char *c = options.only; c != NULL && *c != '\0'; c++) {
+        wanted += *c == ',';
+    }
+
+    if (i >= argc || argv[i][0] == '-' || options.runs < 1 || 
+        options.runs > MAX_RUNS || (options.only != NULL && known != wanted)) {
+        fprintf(stderr, "usage: umbench [-n runs (1-%d)] [-c commit] "
+                "[-w workload,...] [-f json|csv] [-l label] [-p] um "
+                "[um options...]\n  workloads:", MAX_RUNS);
+        for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+            fprintf(stderr, " %s", workloads[w].name);
+        }
+        fprintf(stderr, "\n");
+        exit(EXIT_FAILURE);
+    }
+    options.um_argv = argv + i;
+    options.um_argc = argc - i;
+    return options;
+}
+
+/*
+ * selected
+ * Description:
+ * - Tells whether -w asked for a workload
+ * Parameters:
+ * - The -w list, NULL for every workload (const char *only)
+ * - The workload's name (const char *name)
+ * Returns:
+ * - 1 if the workload should run, 0 otherwise
+ */
+int selected(const char *only, const char *name)
+{
+    if (only == NULL) {
+        return 1;
+    }
+    size_t length = strlen(name);
+    for (const char *item = only; item != NULL; item = strchr(item, ',')) {
+        if (*item == ',') {
+            item++;
+        }
+        if (strncmp(item, name, length) == 0 &&
+            (item[length] == ',' || item[length] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * run_once
+ * Description:
+ * - Runs a workload once, with its input on standard input and its output
+ *   collected in a temporary file
+ * Parameters:
+ * - The workload (const Workload *workload)
+ * - The options, for the UM command and -p (Bench_options *options)
+ * Effects:
+ * - Exits if the UM can't be started
+ * Returns:
+ * - What the run measured (Run)
+ */
+Run run_once(const Workload *workload, Bench_options *options)
+{
+    Run run = { 0.0, 0, -1, -1, 0 };
+    FILE *output = tmpfile();
+    FILE *counters = options->perf ? tmpfile() : NULL;
+    int input = open(workload->input ? workload->input : "/dev/null",
+                     O_RDONLY);
+    if (output == NULL || input < 0 || (options->perf && counters == NULL)) {
+        fprintf(stderr, "Cannot set up %s\n", workload->name);
+        exit(EXIT_FAILURE);
+    }
+
+    /* perf stat -x , -e instructions,cache-misses --log-fd 3 -- um ... */
+    char *perf_args[] = { "perf", "stat", "-x", ",", "-e",
+                          "instructions,cache-misses", "--log-fd", "3", 
+                          "--" };
+    int num_perf = options->perf ? sizeof(perf_args) / sizeof(char *) : 0;
+    int um_argc = options->um_argc;
+    char *args[num_perf + um_argc + 2];
+    memcpy(args, perf_args, num_perf * sizeof(char *));
+    memcpy(args + num_perf, options->um_argv, um_argc * sizeof(char *));
+    args[num_perf + um_argc] = (char *)workload->program;
+    args[num_perf + um_argc + 1] = NULL;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(input, STDIN_FILENO);
+        dup2(fileno(output), STDOUT_FILENO);
+        if (counters != NULL) {
+            dup2(fileno(counters), 3);
+        }
+        execvp(args[0], args);
+        fprintf(stderr, "Cannot run %s\n", args[0]);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) != pid) {
+        fprintf(stderr, "Cannot run %s\n", args[0]);
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(input);
+
+    run.seconds = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    run.peak_kb = usage.ru_maxrss;
+    run.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+             same_output(output, workload->golden);
+    if (!run.ok) {
+        fprintf(stderr, "%s: output differs from %s\n", workload->name,
+                workload->golden);
+    }
+    if (counters != NULL) {
+        read_perf(counters, &run);
+        fclose(counters);
+    }
+    fclose(output);
+    return run;
+}
+
+/*
+ * read_perf
+ * Description:
+ * - Reads the counts perf stat -x , wrote, one "value,unit,event,..." 
+ *   line per event
+ * Parameters:
+ * - What perf stat wrote (FILE *counters)
+ * - The run to record the counts in (Run *run)
+ * Effects:
+ * - Counts perf could not take ("<not supported>") are left at -1
+ * Returns:
+ * - None
+ */
+void read_perf(FILE *counters, Run *run)
+{
+    char line[256];
+    rewind(counters);
+    while (fgets(line, sizeof(line), counters) != NULL) {
+        char *end;
+        double value = strtod(line, &end);
+        char *event = strchr(line, ',');
+        if (end == line || event == NULL || 
+            (event = strchr(event + 1, ',')) == NULL) {
+            continue;
+        }
+        event++;
+        if (strncmp(event, "instructions", 12) == 0) {
+            run->cpu_instructions = value;
+        } else if (strncmp(event, "cache-misses", 12) == 0) {
+            run->cache_misses = value;
+        }
+    }
+}
+
+/*
+ * same_output
+ * Description:
+ * - Compares a run's output with the golden output
+ * Parameters:
+ * - The run's output (FILE *output)
+ * - File holding the golden output (const char *golden)
+ * Returns:
+ * - 1 if they are byte for byte the same, 0 otherwise
+ */
+int same_output(FILE *output, const char *golden)
+{
+    FILE *expected = fopen(golden, "rb");
+    if (expected == NULL) {
+        return 0;
+    }
+    rewind(output);
+
+    int a, b;
+    do {
+        a = getc(output);
+        b = getc(expected);
+    } while (a == b && a != EOF);
+
+    fclose(expected);
+    return a == b;
+}
+
+/*
+ * compare_doubles
+ * Description:
+ * - Orders run times for qsort
+ * Parameters:
+ * - Pointers to two doubles (const void *a, const void *b)
+ * Returns:
+ * - Negative, zero or positive as *a is less than, equal to or greater
+ *   than *b
+ */
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}